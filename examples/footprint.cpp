@@ -0,0 +1,116 @@
+/**
+ *  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file footprint.cpp
+ *
+ * Minimal program used to measure the flash and RAM footprint of Soft323x in
+ * a given configuration, see footprint.sh. The configuration is selected by
+ * the FP_* preprocessor macros below. The class is explicitly instantiated so
+ * that the object file contains each member function, which allows to report
+ * the size of individual functions; the linked program only contains the
+ * functions the AVR example uses.
+ */
+
+#include <stdint.h>
+
+#include "../soft323x/soft323x.hpp"
+
+#ifndef FP_SRAM_SIZE
+#define FP_SRAM_SIZE 0
+#endif
+#ifndef FP_MAILBOX
+#define FP_MAILBOX 0
+#endif
+#ifndef FP_ALARM_TABLE_SIZE
+#define FP_ALARM_TABLE_SIZE 0
+#endif
+#ifndef FP_CAPTURE_FIFO_SIZE
+#define FP_CAPTURE_FIFO_SIZE 0
+#endif
+#ifndef FP_TICK_PERIOD
+#define FP_TICK_PERIOD 0
+#endif
+#ifndef FP_PPS
+#define FP_PPS 0
+#endif
+#ifndef FP_TIMER
+#define FP_TIMER 0
+#endif
+#ifndef FP_DRIFT_ESTIMATOR
+#define FP_DRIFT_ESTIMATOR 0
+#endif
+#ifndef FP_SUBSECOND
+#define FP_SUBSECOND 0
+#endif
+
+struct FootprintConfig : public Soft323xDefaultConfig {
+	static constexpr bool MAILBOX = FP_MAILBOX;
+	static constexpr uint8_t ALARM_TABLE_SIZE = FP_ALARM_TABLE_SIZE;
+	static constexpr uint8_t CAPTURE_FIFO_SIZE = FP_CAPTURE_FIFO_SIZE;
+	static constexpr uint16_t TICK_PERIOD = FP_TICK_PERIOD;
+	static constexpr bool PPS = FP_PPS;
+	static constexpr bool TIMER = FP_TIMER;
+	static constexpr bool DRIFT_ESTIMATOR = FP_DRIFT_ESTIMATOR;
+	static constexpr bool SUBSECOND = FP_SUBSECOND;
+};
+
+using RTC = Soft323x<FP_SRAM_SIZE, FootprintConfig>;
+template class Soft323x<FP_SRAM_SIZE, FootprintConfig>;
+
+static RTC rtc;
+
+/**
+ * Stand-ins for the hardware registers accessed by the ISRs of the example.
+ * Being volatile, they prevent the compiler from removing any of the calls.
+ */
+static volatile uint8_t io_ctrl, io_addr, io_data, io_pec;
+static volatile uint16_t io_count;
+
+int main()
+{
+	for (;;) {
+		const uint8_t ctrl = io_ctrl;
+		if (ctrl & 0x01) {  // Timer ISR
+			rtc.tick();
+			io_count = rtc.next_tick_period();
+		}
+		if (ctrl & 0x02) {  // I2C read
+			io_data = rtc.i2c_read(io_addr);
+			io_addr = rtc.i2c_next_addr(io_addr);
+		}
+		if (ctrl & 0x04) {  // I2C write
+			if (rtc.i2c_write(io_addr, io_data) & RTC::ACTION_RESET_TIMER) {
+				rtc.time_set_phase(io_count);
+				io_count = rtc.timer_preload();
+			}
+			io_addr = rtc.i2c_next_addr(io_addr);
+		}
+		if (ctrl & 0x08) {  // SMBus PEC
+			io_pec = RTC::pec_update(io_pec, io_data);
+		}
+		if (ctrl & 0x10) {  // External events
+			rtc.pps(io_count);
+			rtc.capture(io_count);
+		}
+		if (!(ctrl & 0x80)) {  // Main loop
+			rtc.update();
+			io_ctrl = rtc.interrupt();
+		}
+	}
+}
@@ -0,0 +1,92 @@
+#!/bin/sh
+#  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+#  Copyright (C) 2019  Andreas Stöckel
+#
+#  This program is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU Affero General Public License as
+#  published by the Free Software Foundation, either version 3 of the
+#  License, or (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU Affero General Public License for more details.
+#
+#  You should have received a copy of the GNU Affero General Public License
+#  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+# Compiles footprint.cpp for each configuration in the matrix below and
+# reports the .text, .data and .bss size of the linked program as well as the
+# size of update(), i2c_write() and check_alarms(). Exits with a non-zero
+# status if a configuration exceeds its flash (.text + .data) or RAM
+# (.data + .bss) budget.
+#
+# Usage: ./footprint.sh [DEVICE [CLOCK]]
+
+DEVICE=${1:-atmega168a}
+CLOCK=${2:-8000000}
+CXX=${CXX:-avr-g++}
+SIZE=${SIZE:-avr-size}
+NM=${NM:-avr-nm}
+OUT=${OUT:-footprint}
+
+COMPILE="$CXX -Wall -Wextra -Os -DF_CPU=$CLOCK -mmcu=$DEVICE \
+	-ffunction-sections -fdata-sections"
+
+# Name, SRAM size, comma-separated FP_* macros and -D flags, flash and RAM
+# budget in bytes. The budgets are estimates that have not been measured with
+# avr-g++ yet; tighten them to the reported sizes plus some headroom.
+MATRIX="
+ds3231        0    -                                        6144  64
+ds3232        236  -                                        6144  320
+ds3232_nibble 236  SOFT323X_PEC_NIBBLE_TABLE=1              6144  320
+mailbox       0    FP_MAILBOX=1                             8192  80
+rate          0    FP_TICK_PERIOD=31250,FP_PPS=1,FP_TIMER=1 8192  96
+drift         0    FP_TICK_PERIOD=31250,FP_DRIFT_ESTIMATOR=1,FP_SUBSECOND=1 8192 96
+full          128  FP_MAILBOX=1,FP_ALARM_TABLE_SIZE=8,FP_CAPTURE_FIFO_SIZE=8,FP_TICK_PERIOD=31250,FP_PPS=1,FP_TIMER=1,FP_DRIFT_ESTIMATOR=1,FP_SUBSECOND=1 12288 384
+"
+
+mkdir -p "$OUT" || exit 1
+
+# Prints the size of the member function with the given name in an object file
+fn_size() {
+	"$NM" -C -S "$1" | awk -v fn="::$2(" '
+		index($0, fn) && ($3 == "T" || $3 == "W" || $3 == "t") {
+			s += ("0x" $2) + 0
+		}
+		END { print s + 0 }'
+}
+
+printf "%-14s %6s %6s %6s %6s %6s %9s %6s %12s\n" \
+	config flash ram text data bss i2c_write update check_alarms
+failed=0
+while read name sram defs flash_budget ram_budget; do
+	[ -z "$name" ] && continue
+	flags="-DFP_SRAM_SIZE=$sram"
+	if [ "$defs" != "-" ]; then
+		flags="$flags $(echo "$defs" | sed 's/^/-D/; s/,/ -D/g')"
+	fi
+	$COMPILE $flags -c footprint.cpp -o "$OUT/$name.o" || exit 1
+	$COMPILE -Wl,--gc-sections "$OUT/$name.o" -o "$OUT/$name.elf" || exit 1
+
+	set -- $("$SIZE" "$OUT/$name.elf" | tail -n 1)
+	text=$1 data=$2 bss=$3
+	flash=$((text + data))
+	ram=$((data + bss))
+	printf "%-14s %6d %6d %6d %6d %6d %9d %6d %12d\n" "$name" \
+		$flash $ram $text $data $bss \
+		$(fn_size "$OUT/$name.o" i2c_write) \
+		$(fn_size "$OUT/$name.o" update) \
+		$(fn_size "$OUT/$name.o" check_alarms)
+	if [ $flash -gt $flash_budget ]; then
+		echo "$name: flash $flash exceeds budget $flash_budget" >&2
+		failed=1
+	fi
+	if [ $ram -gt $ram_budget ]; then
+		echo "$name: RAM $ram exceeds budget $ram_budget" >&2
+		failed=1
+	fi
+done <<END
+$MATRIX
+END
+exit $failed
@@ -30,22 +30,164 @@
 #include <stdint.h>
 
 #include "../soft323x/soft323x.hpp"
+#include "../soft323x/soft323x_spi.hpp"
+
+/******************************************************************************
+ * Configuration                                                              *
+ ******************************************************************************/
+
+/**
+ * Set to true to timestamp rising edges on the ICP1 pin (PB0). The debug LED
+ * on PB0 is disabled in this case.
+ */
+static constexpr bool CAPTURE = false;
+
+/**
+ * Set to true to discipline the second timer with a pulse-per-second signal
+ * (e.g. from a GPS receiver) on the INT0 pin (PD2).
+ */
+static constexpr bool PPS = false;
+
+/**
+ * Set to true to correct the rate of the second timer whenever the host sets
+ * the time.
+ */
+static constexpr bool DRIFT = false;
+
+/**
+ * Set to true to let the host align the start of the second to a sub-second
+ * offset written to D6h-D7h before setting the time.
+ */
+static constexpr bool SUBSECOND = false;
+
+/**
+ * The second timer period is computed by the RTC if any of the above is
+ * enabled.
+ */
+static constexpr bool RATE = PPS || DRIFT || SUBSECOND;
+
+/**
+ * Set to true to additionally act as a DS3234 on the SPI bus (SS on PB2, MOSI
+ * on PB3, MISO on PB4, SCK on PB5; SPI mode 1 or 3).
+ */
+static constexpr bool SPI = false;
+
+/**
+ * Set to true to additionally act as a 24C01-style 128-byte memory at I2C
+ * address 0x6C. The address differs from the one of the RTC in a single bit,
+ * so that the TWI address mask does not claim any other address. The memory
+ * is volatile.
+ */
+static constexpr bool I2C_MEMORY = false;
+
+/**
+ * Set to true to emulate the behaviour of the DS3232 on backup power. PD4
+ * must be high while the host supply is down, e.g. driven by a supply
+ * supervisor. The 1 Hz square wave is emulated on INT/SQW (PB1), the 32 kHz
+ * output on OC2B (PD3). EOSC, BBSQW and BB32KHZ select which of them keep
+ * running on battery.
+ */
+static constexpr bool BATTERY = false;
+
+/**
+ * Returns true while the device runs from the backup battery.
+ */
+static bool on_battery() { return BATTERY && (PIND & (1 << PD4)); }
+
+/**
+ * Extensions enabled in the RTC.
+ */
+struct RTCConfig : public Soft323xDefaultConfig {
+	static constexpr uint8_t CAPTURE_FIFO_SIZE = CAPTURE ? 8 : 0;
+	static constexpr uint16_t TICK_PERIOD = RATE ? (F_CPU / 256L) : 0;
+	static constexpr bool PPS = ::PPS;
+	static constexpr bool DRIFT_ESTIMATOR = DRIFT;
+	static constexpr bool SUBSECOND = ::SUBSECOND;
+	using Power = Soft323xPowerCallback<on_battery>;
+};
+
+/**
+ * Minimal I2C memory with a one-byte address pointer that wraps around at the
+ * end, providing the same interface as Soft323x to the TWI state machine.
+ */
+template <uint8_t SIZE>
+class I2cMemory {
+private:
+	uint8_t m_mem[SIZE];
+
+public:
+	uint8_t i2c_read(uint8_t addr) const { return m_mem[addr % SIZE]; }
+
+	uint8_t i2c_write(uint8_t addr, uint8_t value)
+	{
+		m_mem[addr % SIZE] = value;
+		return 0;
+	}
+
+	uint8_t i2c_next_addr(uint8_t addr) { return (addr + 1U) % SIZE; }
+
+	static constexpr bool i2c_block_end(uint8_t addr)
+	{
+		return addr == SIZE - 1U;
+	}
+
+	bool update() { return false; }
+
+	void i2c_stop() {}
+};
 
 /******************************************************************************
  * Global variables                                                           *
  ******************************************************************************/
 
-static Soft323x<> rtc;
+using RTC = Soft323x<0, RTCConfig>;
+
+static RTC rtc;
+static Soft323xSpi<RTC> spi(rtc);
+static I2cMemory<I2C_MEMORY ? 128 : 1> memory;
+
+/**
+ * Parts of the device that are currently powered, see power_update().
+ */
+static volatile uint8_t power =
+    RTC::POWER_OSCILLATOR | RTC::POWER_INT_SQW | RTC::POWER_BUS;
 
 /******************************************************************************
  * Timer 1 as second clock                                                    *
  ******************************************************************************/
 
-ISR(TIMER1_COMPA_vect) { rtc.tick(); }
+/**
+ * Commits a compare match of the second timer: advances the RTC, programs
+ * the period of the next second and starts the square wave period. Called
+ * by the compare ISR and by the ISRs that commit a pending compare match
+ * before it runs.
+ */
+static void timer1_commit_tick()
+{
+	rtc.tick();
+	if (RATE) {
+		OCR1A = rtc.next_tick_period() - 1U;
+	}
+	if (BATTERY && (power & RTC::POWER_SQW)) {
+		DDRB |= 0x02;  // Falling edge of the square wave
+		OCR1B = OCR1A / 2U;
+	}
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+	timer1_commit_tick();
+}
+
+ISR(TIMER1_COMPB_vect)
+{
+	DDRB &= ~0x02;  // Rising edge of the square wave
+}
 
 static void timer1_reset()
 {
-	TCNT1 = 0;  // Reset the counter
+	rtc.time_set_phase(TCNT1);
+	TCNT1 = rtc.timer_preload();  // Reset the counter
 }
 
 static void timer1_init()
@@ -54,6 +196,68 @@ static void timer1_init()
 	OCR1A = F_CPU / 256L;    // This is an integer for f_clkCPU = 8Mhz
 	TIMSK1 = (1 << OCIE1A);  // Enable overflow interrupt
 	TCCR1B = (1 << WGM12) | (1 << CS12);  // CTC mode; f = f_clkCPU / 256
+	if (CAPTURE) {
+		TIMSK1 |= (1 << ICIE1);  // Enable the input capture interrupt
+		TCCR1B |= (1 << ICES1);  // Capture on the rising edge
+	}
+	if (RATE) {
+		OCR1A = rtc.next_tick_period() - 1U;
+	}
+	if (PPS) {
+		EICRA = (1 << ISC01) | (1 << ISC00);  // INT0 on the rising edge
+		EIMSK = (1 << INT0);
+	}
+}
+
+ISR(INT0_vect)
+{
+	// Same as for the timestamp capture below; the PPS edge must be attributed
+	// to the correct second.
+	const uint16_t count = TCNT1;
+	if ((TIFR1 & (1 << OCF1A)) && count < (F_CPU / 512L)) {
+		TIFR1 = (1 << OCF1A);
+		timer1_commit_tick();
+	}
+	rtc.pps(count);
+}
+
+/******************************************************************************
+ * Event timestamp capture                                                    *
+ ******************************************************************************/
+
+ISR(TIMER1_CAPT_vect)
+{
+	// The timer hardware latched the counter into ICR1. If the counter wrapped
+	// before the event but the compare ISR did not run yet, commit the tick
+	// first -- otherwise the timestamp would be off by one second.
+	const uint16_t count = ICR1;
+	if ((TIFR1 & (1 << OCF1A)) && count < (F_CPU / 512L)) {
+		TIFR1 = (1 << OCF1A);
+		timer1_commit_tick();
+	}
+	rtc.capture(count);
+}
+
+/******************************************************************************
+ * Interrupt output                                                           *
+ ******************************************************************************/
+
+/**
+ * Emulates the open-drain INT/SQW output of the DS3232 on PB1. The pin is
+ * pulled low while the interrupt is asserted and floats otherwise; an external
+ * pull-up resistor is required.
+ */
+static void int_update()
+{
+	if (BATTERY && (power & RTC::POWER_SQW)) {
+		return;  // The pin is driven by the timer
+	}
+	if (rtc.interrupt() && (power & RTC::POWER_INT_SQW)) {
+		DDRB |= 0x02;
+	}
+	else {
+		DDRB &= ~0x02;
+	}
 }
 
 /******************************************************************************
@@ -66,6 +270,22 @@ static constexpr uint8_t I2C_HAS_ADDR = 2;
 static constexpr uint8_t I2C_SEND_READY = 3;
 static constexpr uint8_t I2C_SEND_BYTE = 4;
 static constexpr uint8_t I2C_RECV_BYTE = 5;
+static constexpr uint8_t I2C_SEND_BLOCK_END = 6;
+static constexpr uint8_t I2C_SEND_PEC = 7;
+
+/**
+ * Set to true to enable SMBus packet error checking (PEC). Writes are buffered
+ * and only committed if the PEC byte sent by the master after the last data
+ * byte is correct. Reads are terminated by a PEC byte after the last register
+ * of the block the read started in (see Soft323x::i2c_block_end()).
+ */
+static constexpr bool I2C_PEC = false;
+
+/**
+ * Maximum number of bytes (including the PEC) in a write transaction if PEC
+ * is enabled. Longer writes are discarded.
+ */
+static constexpr uint8_t I2C_PEC_BUF_SIZE = 16;
 
 /**
  * The address the bus master would like to read.
@@ -77,6 +297,22 @@ volatile uint8_t i2c_addr;
  */
 volatile uint8_t i2c_status;
 
+/**
+ * PEC computed over all bytes of the current transaction.
+ */
+volatile uint8_t i2c_pec;
+
+/**
+ * Buffer holding the bytes written by the master if PEC is enabled.
+ */
+static uint8_t i2c_buf[I2C_PEC ? I2C_PEC_BUF_SIZE : 1];
+volatile uint8_t i2c_buf_len;
+
+/**
+ * Number of write transactions discarded because of a PEC mismatch.
+ */
+volatile uint8_t i2c_pec_errors;
+
 static void i2c_ack()
 {
 	// Enable TWI, clear the TWINT flag, enable address matching, enable TWI
@@ -84,57 +320,103 @@ static void i2c_ack()
 	TWCR = (1 << TWIE) | (1 << TWEA) | (1 << TWINT) | (1 << TWEN);
 }
 
-static void i2c_listen(uint8_t addr)
+template <typename Device, Device *dev>
+static void i2c_commit_byte(uint8_t value)
 {
-	// Reset the internal state
-	i2c_addr = 0;
-	i2c_status = 0;
-
-	// Set the listen address
-	TWAR = (addr & 0x7F) << 1;
-
-	// Prepare for incoming data
-	i2c_ack();
+	if (dev->i2c_write(i2c_addr, value) & RTC::ACTION_RESET_TIMER) {
+		timer1_reset();
+	}
+	i2c_addr = dev->i2c_next_addr(i2c_addr);
 }
 
+/**
+ * TWI slave state machine for a single device. It is instantiated for each
+ * device in I2C_DEVICES; the device is a template parameter so that all calls
+ * are resolved at compile time.
+ */
+template <typename Device, Device *dev>
 static uint8_t i2c_state_machine(uint8_t tw_status) {
 	switch (tw_status) {
 		/* Slave receiver (SR): The master tries to write to this device */
 		case TW_SR_SLA_ACK:
 			i2c_addr = 0;
-			rtc.update();
+			if (I2C_PEC) {
+				i2c_pec = RTC::pec_update(0, TWDR);
+				i2c_buf_len = 0;
+			}
+			dev->update();
 			return I2C_START;
 		case TW_SR_DATA_ACK:
+			if (I2C_PEC) {
+				i2c_pec = RTC::pec_update(i2c_pec, TWDR);
+			}
 			if (i2c_status == I2C_START) {
 				i2c_addr = TWDR;
 				return I2C_HAS_ADDR;
 			}
 			else if (i2c_status == I2C_HAS_ADDR ||
 			         i2c_status == I2C_RECV_BYTE) {
-				switch (rtc.i2c_write(i2c_addr, TWDR)) {
-					case rtc.ACTION_RESET_TIMER:
-						timer1_reset();
-						break;
-						// TODO
-						break;
+				if (I2C_PEC) {
+					// Buffer the data until the PEC has been checked
+					if (i2c_buf_len < I2C_PEC_BUF_SIZE) {
+						i2c_buf[i2c_buf_len] = TWDR;
+					}
+					if (i2c_buf_len < 0xFF) {
+						i2c_buf_len++;
+					}
+				}
+				else {
+					i2c_commit_byte<Device, dev>(TWDR);
 				}
-				i2c_addr = rtc.i2c_next_addr(i2c_addr);
 				return I2C_RECV_BYTE;
 			}
 			break;
 		case TW_SR_STOP:
+			// STOP or repeated START
+			dev->i2c_stop();
 			if (i2c_status == I2C_HAS_ADDR) {
 				return I2C_SEND_READY;
 			}
+			if (I2C_PEC && i2c_status == I2C_RECV_BYTE) {
+				// The last byte is the PEC; the PEC over all bytes including
+				// the PEC itself is zero if the transmission is correct
+				if (i2c_pec == 0 && i2c_buf_len <= I2C_PEC_BUF_SIZE) {
+					for (uint8_t i = 0; i + 1 < i2c_buf_len; i++) {
+						i2c_commit_byte<Device, dev>(i2c_buf[i]);
+					}
+				}
+				else {
+					i2c_pec_errors++;
+				}
+			}
 			break;
 
 		/* Slave transmitter (ST): The master tries to read data from this
 		   device */
 		case TW_ST_SLA_ACK:
+			if (I2C_PEC) {
+				// Continue the PEC of the address write preceding the
+				// repeated start, otherwise start a new one
+				i2c_pec = RTC::pec_update(
+				    (i2c_status == I2C_SEND_READY) ? i2c_pec : 0, TWDR);
+			}
+			// fallthrough
 		case TW_ST_DATA_ACK:
+			if (I2C_PEC && i2c_status == I2C_SEND_BLOCK_END) {
+				TWDR = i2c_pec;
+				return I2C_SEND_PEC;
+			}
 			if (i2c_status == I2C_SEND_READY || i2c_status == I2C_SEND_BYTE) {
-				TWDR = rtc.i2c_read(i2c_addr);
-				i2c_addr = rtc.i2c_next_addr(i2c_addr);
+				const uint8_t value = dev->i2c_read(i2c_addr);
+				TWDR = value;
+				if (I2C_PEC) {
+					i2c_pec = RTC::pec_update(i2c_pec, value);
+					if (dev->i2c_block_end(i2c_addr)) {
+						i2c_addr = dev->i2c_next_addr(i2c_addr);
+						return I2C_SEND_BLOCK_END;
+					}
+				}
+				i2c_addr = dev->i2c_next_addr(i2c_addr);
 				return I2C_SEND_BYTE;
 			}
 			break;
@@ -149,12 +431,259 @@ static uint8_t i2c_state_machine(uint8_t tw_status) {
 	return I2C_IDLE;
 }
 
+/**
+ * State machine for addresses matched by the address mask but not belonging to
+ * any device. Written bytes are ignored, reads return FFh.
+ */
+static uint8_t i2c_state_machine_none(uint8_t tw_status)
+{
+	if (tw_status == TW_ST_SLA_ACK || tw_status == TW_ST_DATA_ACK) {
+		TWDR = 0xFF;
+	}
+	return I2C_IDLE;
+}
+
+/**
+ * Addresses of the devices served on the I2C bus. Only the first
+ * I2C_N_DEVICES entries are active; the index of an entry selects its state
+ * machine in i2c_dispatch().
+ */
+static constexpr uint8_t I2C_DEVICES[] = {
+    0x68,  // DS3232
+    0x6C,  // I2cMemory
+};
+
+static constexpr uint8_t I2C_N_DEVICES = I2C_MEMORY ? 2 : 1;
+
+/**
+ * Computes the TWAMR address mask, i.e. the address bits in which the device
+ * addresses differ. The TWI hardware acknowledges every address matching TWAR
+ * in the remaining bits before the ISR can intervene, so the addresses must
+ * be chosen such that the mask does not cover any address that is not in
+ * I2C_DEVICES, e.g. 0x68 and 0x6C.
+ */
+static constexpr uint8_t i2c_addr_mask(uint8_t i = 1)
+{
+	return (i >= I2C_N_DEVICES)
+	           ? 0
+	           : ((I2C_DEVICES[i] ^ I2C_DEVICES[0]) | i2c_addr_mask(i + 1));
+}
+
+/**
+ * Returns the number of addresses acknowledged with the given address mask.
+ */
+static constexpr uint8_t i2c_addr_count(uint8_t mask)
+{
+	return mask ? uint8_t((mask & 1U) ? 2U * i2c_addr_count(mask >> 1)
+	                                  : i2c_addr_count(mask >> 1))
+	            : 1U;
+}
+
+/**
+ * Returns true if the addresses of the active devices are pairwise distinct.
+ */
+static constexpr bool i2c_addr_unique(uint8_t i = 0, uint8_t j = 1)
+{
+	return (i >= I2C_N_DEVICES)
+	           ? true
+	           : (j >= I2C_N_DEVICES)
+	                 ? i2c_addr_unique(i + 1, i + 2)
+	                 : (I2C_DEVICES[i] != I2C_DEVICES[j] &&
+	                    i2c_addr_unique(i, j + 1));
+}
+
+static_assert(i2c_addr_unique() &&
+                  i2c_addr_count(i2c_addr_mask()) == I2C_N_DEVICES,
+              "The TWI address mask must only match the configured devices");
+
+/**
+ * Index of the device addressed in the current transaction in I2C_DEVICES,
+ * or I2C_N_DEVICES if no device matches. Selected once per SLA+R/W.
+ */
+volatile uint8_t i2c_device;
+
+static void i2c_select_device(uint8_t addr)
+{
+	i2c_device = I2C_N_DEVICES;
+	for (uint8_t i = 0; i < I2C_N_DEVICES; i++) {
+		if (I2C_DEVICES[i] == addr) {
+			i2c_device = i;
+			break;
+		}
+	}
+}
+
+/**
+ * Passes the TWI status to the state machine of the selected device. The
+ * state machines are called directly, so they can be inlined into the ISR.
+ */
+static uint8_t i2c_dispatch(uint8_t tw_status)
+{
+	switch ((I2C_N_DEVICES > 1) ? i2c_device : 0) {
+		case 0:
+			return i2c_state_machine<RTC, &rtc>(tw_status);
+		case 1:
+			return i2c_state_machine<I2cMemory<I2C_MEMORY ? 128 : 1>,
+			                         &memory>(tw_status);
+		default:
+			return i2c_state_machine_none(tw_status);
+	}
+}
+
+static void i2c_listen()
+{
+	// Reset the internal state
+	i2c_addr = 0;
+	i2c_status = 0;
+
+	// Set the listen address and the address mask
+	TWAR = (I2C_DEVICES[0] & 0x7F) << 1;
+	TWAMR = (i2c_addr_mask() & 0x7F) << 1;
+
+	// Prepare for incoming data
+	i2c_ack();
+}
+
 ISR(TWI_vect)
 {
-	i2c_status = i2c_state_machine(TW_STATUS);
+	const uint8_t tw_status = TW_STATUS;
+	if (I2C_N_DEVICES > 1 &&
+	    (tw_status == TW_SR_SLA_ACK || tw_status == TW_ST_SLA_ACK)) {
+		i2c_select_device(TWDR >> 1);
+	}
+	i2c_status = i2c_dispatch(tw_status);
 	i2c_ack();
 }
 
+/******************************************************************************
+ * SPI Interface                                                              *
+ ******************************************************************************/
+
+static void spi_init()
+{
+	DDRB |= (1 << PB4);  // MISO is an output
+	SPCR = (1 << SPIE) | (1 << SPE) | (1 << CPHA);  // Slave, mode 1
+	PCMSK0 = (1 << PCINT2);  // Pin change interrupt on SS
+	PCICR |= (1 << PCIE0);
+}
+
+ISR(PCINT0_vect)
+{
+	if (!(PINB & (1 << PB2))) {
+		spi.select();
+		SPDR = 0;
+	}
+	else if (spi.active() && (spi.deselect() & rtc.ACTION_RESET_TIMER)) {
+		timer1_reset();
+	}
+}
+
+ISR(SPI_STC_vect)
+{
+	SPDR = spi.transfer(SPDR);
+	if (spi.consume_actions() & rtc.ACTION_RESET_TIMER) {
+		timer1_reset();  // Right after the seconds register was written
+	}
+}
+
+/******************************************************************************
+ * Backup power                                                               *
+ ******************************************************************************/
+
+/**
+ * Gates the second timer, the outputs and the bus interfaces according to
+ * Soft323x::power_state() and selects the deepest sleep mode in which the
+ * remaining parts keep running. Both timers are clocked from the I/O clock,
+ * so this is idle mode as long as the oscillator runs and power-down once it
+ * is stopped (EOSC on battery). The CPU is then only woken up by the pin
+ * change on PD4 when the host supply returns.
+ */
+static void power_update()
+{
+	uint8_t p = rtc.power_state();
+	if (rtc.i2c_read(RTC::REG_CTRL_1) &
+	    (RTC::BIT_CTRL_1_RS2 | RTC::BIT_CTRL_1_RS1)) {
+		p &= ~RTC::POWER_SQW;  // Only the 1 Hz square wave is emulated
+	}
+	const uint8_t changed = p ^ power;
+	power = p;
+
+	// Second timer. Stopping its clock keeps the phase of the second.
+	if (changed & RTC::POWER_OSCILLATOR) {
+		if (p & RTC::POWER_OSCILLATOR) {
+			TCCR1B |= (1 << CS12);
+		}
+		else {
+			TCCR1B &= ~(1 << CS12);
+		}
+	}
+
+	// The square wave is pulled low for the first half of each second
+	if (changed & RTC::POWER_SQW) {
+		if (p & RTC::POWER_SQW) {
+			OCR1B = OCR1A / 2U;
+			TIMSK1 |= (1 << OCIE1B);
+		}
+		else {
+			TIMSK1 &= ~(1 << OCIE1B);
+		}
+	}
+
+	// 32 kHz output: Timer 2 in CTC mode toggling OC2B, i.e. 32.787 kHz for
+	// f_clkCPU = 8 MHz
+	if (changed & RTC::POWER_32KHZ) {
+		if (p & RTC::POWER_32KHZ) {
+			PRR &= ~(1 << PRTIM2);
+			OCR2A = F_CPU / 65536L - 1U;
+			TCCR2A = (1 << COM2B0) | (1 << WGM21);
+			TCCR2B = (1 << CS20);
+			DDRD |= (1 << PD3);
+		}
+		else {
+			DDRD &= ~(1 << PD3);
+			TCCR2A = 0;
+			TCCR2B = 0;
+			PRR |= (1 << PRTIM2);
+		}
+	}
+
+	// The bus interfaces are inaccessible on battery; abort any transaction
+	// the host did not finish
+	if (changed & RTC::POWER_BUS) {
+		if (p & RTC::POWER_BUS) {
+			PRR &= ~((1 << PRTWI) | (1 << PRSPI));
+			i2c_listen();
+			if (SPI) {
+				spi_init();
+			}
+		}
+		else {
+			TWCR = 0;
+			SPCR = 0;
+			PCICR &= ~(1 << PCIE0);
+			PRR |= (1 << PRTWI) | (1 << PRSPI);
+			i2c_status = I2C_IDLE;
+			spi.deselect();
+		}
+	}
+
+	set_sleep_mode((p & RTC::POWER_OSCILLATOR) ? SLEEP_MODE_IDLE
+	                                           : SLEEP_MODE_PWR_DOWN);
+}
+
+static void power_init()
+{
+	PCMSK2 = (1 << PCINT20);  // Pin change interrupt on PD4
+	PCICR |= (1 << PCIE2);
+	power_update();
+}
+
+ISR(PCINT2_vect)
+{
+	// Apply the new supply state before the main loop goes back to sleep
+	power_update();
+}
+
 /******************************************************************************
  * MAIN PROGRAM                                                               *
  ******************************************************************************/
@@ -168,13 +697,22 @@ int main()
 	set_sleep_mode(SLEEP_MODE_IDLE);
 
 	// Debug port for blinking LED
-	DDRB |= 0x01;
+	if (!CAPTURE) {
+		DDRB |= 0x01;
+	}
 
 	// Initialize the timer
 	timer1_init();
 
-	// Listen on I2C address 0x68 (corresponding to the DS3232)
-	i2c_listen(0x68);
+	// Listen on I2C address 0x68 (corresponding to the DS3232) and the
+	// addresses of the other devices
+	i2c_listen();
+	if (SPI) {
+		spi_init();
+	}
+	if (BATTERY) {
+		power_init();
+	}
 
 	// Enable interrupts
 	sei();
@@ -186,10 +724,14 @@ int main()
 		// Only update the RTC if the I2C bus is not busy at the moment
 		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 		{
-			if (i2c_status == I2C_IDLE) {
-				if (rtc.update()) {
+			if (BATTERY) {
+				power_update();  // The control registers may have changed
+			}
+			if (i2c_status == I2C_IDLE && !spi.active()) {
+				if (rtc.update() && !CAPTURE) {
 					PORTB ^= 0x01; // Toggle an LED
 				}
+				int_update();
 			}
 		}
 	}
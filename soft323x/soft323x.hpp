@@ -33,10 +33,375 @@
 #include <stdint.h>
 
 #if __AVR__
+#include <avr/pgmspace.h>
 #include <util/atomic.h>
+#define SOFT323X_PROGMEM PROGMEM
+#define SOFT323X_PGM_READ(x) pgm_read_byte(&(x))
 #else
+#if !SOFT323X_NO_STD_ATOMIC
 #include <atomic>
 #endif
+#define SOFT323X_PROGMEM
+#define SOFT323X_PGM_READ(x) (x)
+#endif
+
+/**
+ * Define SOFT323X_PEC_NIBBLE_TABLE as 1 to compute the SMBus PEC using a
+ * 16-byte lookup table instead of a 256-byte table. This saves flash at the
+ * cost of a few cycles per byte.
+ */
+#ifndef SOFT323X_PEC_NIBBLE_TABLE
+#define SOFT323X_PEC_NIBBLE_TABLE 0
+#endif
+
+/**
+ * Policies implementing the counter of the ticks not yet committed by
+ * update(). tick() calls increment() from the timer ISR, update() calls
+ * consume(), which atomically reads the counter, resets it to zero and passes
+ * the number of ticks to the given function. The function is executed inside
+ * the critical section if the policy has one. load() returns the counter
+ * without modifying it.
+ *
+ * All policies assume a single core on which the ISR calling tick() cannot be
+ * interrupted by the code calling update(). increment() thus only has to be
+ * atomic if the policy says so. The policy is selected by Config::Ticks; the
+ * default is Soft323xTicksAvr on AVRs and Soft323xTicksStd elsewhere. Define
+ * SOFT323X_NO_STD_ATOMIC as 1 on freestanding toolchains without a usable
+ * <atomic> header; the default then is Soft323xTicksSwap.
+ */
+#if __AVR__
+/**
+ * Disables the interrupts while consuming the ticks.
+ */
+struct Soft323xTicksAvr {
+	volatile uint8_t value;
+
+	void increment() { value = value + 1U; }
+
+	uint8_t load() const { return value; }
+
+	template <typename F>
+	uint8_t consume(F commit)
+	{
+		uint8_t ticks;
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			ticks = value;
+			value = 0U;
+			commit(ticks);
+		}
+		return ticks;
+	}
+};
+#endif
+
+#if !__AVR__ && !SOFT323X_NO_STD_ATOMIC
+/**
+ * Uses std::atomic, which may be implemented using locks on some targets.
+ */
+struct Soft323xTicksStd {
+	std::atomic<uint8_t> value;
+
+	void increment() { value++; }
+
+	uint8_t load() const { return value; }
+
+	template <typename F>
+	uint8_t consume(F commit)
+	{
+		const uint8_t ticks = value.exchange(0U);
+		commit(ticks);
+		return ticks;
+	}
+};
+#endif
+
+#if defined(__GNUC__)
+/**
+ * Consumes the ticks with the __atomic_exchange_n() compiler builtin, which
+ * must be a single lock-free instruction on the target (such as XCHG on x86,
+ * SWPB on ARMv5, AMOSWAP on RISC-V with the Zabha extension).
+ */
+struct Soft323xTicksSwap {
+	volatile uint8_t value;
+
+	void increment() { value = value + 1U; }
+
+	uint8_t load() const { return value; }
+
+	template <typename F>
+	uint8_t consume(F commit)
+	{
+		static_assert(__atomic_always_lock_free(sizeof(value), 0),
+		              "Byte-sized atomic exchange is not lock-free");
+		const uint8_t ticks =
+		    __atomic_exchange_n(&value, uint8_t(0U), __ATOMIC_ACQ_REL);
+		commit(ticks);
+		return ticks;
+	}
+};
+#endif
+
+#if defined(__arm__) && defined(__ARM_ARCH_PROFILE) && \
+    __ARM_ARCH_PROFILE == 'M'
+/**
+ * Masks the interrupts using PRIMASK while consuming the ticks. Works on all
+ * Cortex-M cores including the ARMv6-M Cortex-M0/M0+.
+ */
+struct Soft323xTicksPrimask {
+	volatile uint8_t value;
+
+	void increment() { value = value + 1U; }
+
+	uint8_t load() const { return value; }
+
+	template <typename F>
+	uint8_t consume(F commit)
+	{
+		uint32_t primask;
+		__asm__ volatile("mrs %0, primask\n\tcpsid i"
+		                 : "=r"(primask)
+		                 :
+		                 : "memory");
+		const uint8_t ticks = value;
+		value = 0U;
+		commit(ticks);
+		__asm__ volatile("msr primask, %0" ::"r"(primask) : "memory");
+		return ticks;
+	}
+};
+#endif
+
+#if defined(__arm__) && defined(__ARM_FEATURE_LDREX) && \
+    (__ARM_FEATURE_LDREX & 1)
+/**
+ * Consumes the ticks with an LDREXB/STREXB loop without masking interrupts
+ * (ARMv7-M and later). An exception between the two instructions clears the
+ * exclusive monitor, in which case the loop is repeated.
+ */
+struct Soft323xTicksExclusive {
+	volatile uint8_t value;
+
+	void increment() { value = value + 1U; }
+
+	uint8_t load() const { return value; }
+
+	template <typename F>
+	uint8_t consume(F commit)
+	{
+		// The load, the store and the retry loop are a single asm statement,
+		// so the compiler cannot place memory accesses in between that would
+		// clear the exclusive monitor
+		uint32_t ticks, failed;
+		__asm__ volatile(
+		    "1: ldrexb %0, [%2]\n"
+		    "   strexb %1, %3, [%2]\n"
+		    "   cmp %1, #0\n"
+		    "   bne 1b"
+		    : "=&r"(ticks), "=&r"(failed)
+		    : "r"(&value), "r"(0U)
+		    : "cc", "memory");
+		commit(uint8_t(ticks));
+		return uint8_t(ticks);
+	}
+};
+#endif
+
+#if defined(__riscv) && defined(__riscv_atomic)
+/**
+ * Consumes the ticks with an AMOAND.W on the aligned word containing the
+ * counter, clearing only the byte of the counter (RISC-V "A" extension).
+ */
+struct Soft323xTicksAmo {
+	volatile uint8_t value;
+
+	void increment() { value = value + 1U; }
+
+	uint8_t load() const { return value; }
+
+	template <typename F>
+	uint8_t consume(F commit)
+	{
+		const uintptr_t addr = uintptr_t(&value);
+		volatile uint32_t *word = (volatile uint32_t *)(addr & ~uintptr_t(3));
+		const uint32_t shift = uint32_t(addr & 3U) * 8U;
+		uint32_t old;
+		__asm__ volatile("amoand.w.aqrl %0, %2, %1"
+		                 : "=r"(old), "+A"(*word)
+		                 : "r"(~(uint32_t(0xFFU) << shift))
+		                 : "memory");
+		const uint8_t ticks = uint8_t(old >> shift);
+		commit(ticks);
+		return ticks;
+	}
+};
+#endif
+
+#if __AVR__
+using Soft323xTicksDefault = Soft323xTicksAvr;
+#elif !SOFT323X_NO_STD_ATOMIC
+using Soft323xTicksDefault = Soft323xTicksStd;
+#else
+using Soft323xTicksDefault = Soft323xTicksSwap;
+#endif
+
+/**
+ * Identifiers of the code paths instrumented with probes.
+ */
+struct Soft323xProbePath {
+	static constexpr uint8_t TICK = 0;
+	static constexpr uint8_t UPDATE = 1;
+	static constexpr uint8_t INCREMENT_TIME = 2;
+	static constexpr uint8_t CHECK_ALARMS = 3;
+	static constexpr uint8_t I2C_READ = 4;
+	static constexpr uint8_t I2C_WRITE = 5;
+	static constexpr uint8_t COUNT = 6;
+};
+
+/**
+ * Probe policy selected by Config::Probe. begin() and end() are called with
+ * one of the Soft323xProbePath identifiers on entry and exit of the
+ * corresponding function. Paths may nest, e.g. update() calls
+ * increment_time(), and i2c_write() may be entered recursively by the mailbox.
+ * This default policy does nothing and is optimised away entirely; see
+ * soft323x_probe.hpp for policies measuring the execution time.
+ */
+struct Soft323xProbeNone {
+	static void begin(uint8_t) {}
+	static void end(uint8_t) {}
+};
+
+/**
+ * Power policy selected by Config::Power. on_battery() returns true while the
+ * device runs from the backup battery, i.e. while the host supply is below
+ * the power-fail threshold. This default policy assumes that the device is
+ * always supplied by the host; the registers controlling the battery-backed
+ * operation (EOSC, BBSQW, BB32KHZ) then have no effect.
+ */
+struct Soft323xPowerMains {
+	static constexpr bool on_battery() { return false; }
+};
+
+/**
+ * Power policy querying the supply state from the given function, e.g. one
+ * reading a comparator or a GPIO connected to the host supply.
+ */
+template <bool (*F)()>
+struct Soft323xPowerCallback {
+	static bool on_battery() { return F(); }
+};
+
+/**
+ * Default compile-time configuration of the Soft323x class. All extensions
+ * beyond the DS3232 register set are disabled. To enable an extension, derive
+ * a new configuration from this struct and override the corresponding
+ * constant, e.g.
+ *
+ *     struct MyConfig : public Soft323xDefaultConfig {
+ *         static constexpr bool MAILBOX = true;
+ *     };
+ *     Soft323x<16, MyConfig> rtc;
+ *
+ * The registers of the extensions are mapped to fixed addresses at the upper
+ * end of the I2C address space. Disabled extensions occupy no memory, but the
+ * SRAM must not overlap with the registers of any enabled extension.
+ */
+struct Soft323xDefaultConfig {
+	/**
+	 * Enables the command mailbox at F0h-F8h. The host writes a 64-bit time
+	 * stamp or a packed register image to F0h-F7h and then a command to F8h.
+	 * The command is applied in a single step.
+	 */
+	static constexpr bool MAILBOX = false;
+
+	/**
+	 * Number of entries in the extended alarm table at E8h-EFh (at most 127).
+	 * Each entry consists of an absolute UNIX time stamp and a user-defined
+	 * tag and requires five bytes of RAM. Zero disables the alarm table.
+	 */
+	static constexpr uint8_t ALARM_TABLE_SIZE = 0;
+
+	/**
+	 * Number of entries in the event timestamp capture FIFO at E0h-E7h. Must
+	 * be a power of two (at most 128). Each entry requires seven bytes of RAM.
+	 * Zero disables the capture registers.
+	 */
+	static constexpr uint8_t CAPTURE_FIFO_SIZE = 0;
+
+	/**
+	 * Nominal number of second timer counts per second. If non-zero, the
+	 * second timer period is computed by next_tick_period() using a
+	 * fractional accumulator, which allows to correct the rate of the timer.
+	 */
+	static constexpr uint16_t TICK_PERIOD = 0;
+
+	/**
+	 * If true, the tick rate is disciplined by an external pulse-per-second
+	 * signal, see pps(). Requires TICK_PERIOD to be set.
+	 */
+	static constexpr bool PPS = false;
+
+	/**
+	 * Enables the countdown timer at D8h-DCh. The timer counts down a 16-bit
+	 * number of seconds, sets a flag when reaching zero and is optionally
+	 * reloaded, similar to the timer of the PCF8563.
+	 */
+	static constexpr bool TIMER = false;
+
+	/**
+	 * If true, the tick rate is corrected using the time differences observed
+	 * whenever the host sets the time, see time_set_phase(). Requires
+	 * TICK_PERIOD to be set.
+	 */
+	static constexpr bool DRIFT_ESTIMATOR = false;
+
+	/**
+	 * Enables the sub-second offset register at D6h-D7h. The offset written
+	 * there is applied by the next write to the seconds register, see
+	 * timer_preload(). Since the address wraps from D7h to D8h, the time must
+	 * be written in the following write message, or through the mailbox.
+	 * Requires TICK_PERIOD to be set.
+	 */
+	static constexpr bool SUBSECOND = false;
+
+	/**
+	 * Policy used to count the ticks not yet committed by update(), see
+	 * Soft323xTicksDefault.
+	 */
+	using Ticks = Soft323xTicksDefault;
+
+	/**
+	 * Policy notified on entry and exit of the hot paths, see
+	 * Soft323xProbeNone.
+	 */
+	using Probe = Soft323xProbeNone;
+
+	/**
+	 * Policy reporting whether the device runs from the backup battery, see
+	 * Soft323xPowerMains and power_state().
+	 */
+	using Power = Soft323xPowerMains;
+};
+
+/**
+ * Storage of an optional extension of the Soft323x class, holding a T if
+ * ENABLED is true and nothing otherwise. get() of a disabled extension must
+ * not be called; the calls are only compiled in branches on the constant
+ * configuration that are never taken.
+ */
+template <typename T, bool ENABLED>
+struct Soft323xOptional {
+	T value;
+
+	T &get() { return value; }
+	const T &get() const { return value; }
+};
+
+template <typename T>
+struct Soft323xOptional<T, false> {
+	T &get() { return *reinterpret_cast<T *>(this); }
+	const T &get() const { return *reinterpret_cast<const T *>(this); }
+};
 
 #pragma pack(push, 1)
 /**
@@ -53,8 +418,10 @@
  *
  * @tparam SRAM_SIZE is the size of the user-exposed SRAM in bytes. For a DS3232
  * this value should be 236, for a DS3231 it should be 0.
+ * @tparam Config is a struct selecting the optional extensions, see
+ * Soft323xDefaultConfig.
  */
-template <unsigned int SRAM_SIZE = 0>
+template <unsigned int SRAM_SIZE = 0, typename Config = Soft323xDefaultConfig>
 class Soft323x {
 private:
 	/**************************************************************************
@@ -103,15 +470,183 @@ private:
 		uint8_t mem[sizeof(Registers)];
 	} m_regs;
 
+	/**
+	 * Registers of the optional extensions located at the upper end of the
+	 * address space. The arrays belonging to disabled extensions have zero
+	 * length.
+	 */
+	static constexpr bool HAS_RATE = Config::TICK_PERIOD > 0;
+
+	static_assert(!Config::PPS || HAS_RATE,
+	              "PPS discipline requires TICK_PERIOD to be set");
+	static_assert(!Config::DRIFT_ESTIMATOR || HAS_RATE,
+	              "The drift estimator requires TICK_PERIOD to be set");
+	static_assert(!Config::SUBSECOND || HAS_RATE,
+	              "The sub-second offset requires TICK_PERIOD to be set");
+
+	static constexpr bool HAS_EPOCH_CACHE =
+	    Config::ALARM_TABLE_SIZE > 0 || Config::CAPTURE_FIFO_SIZE > 0;
+
+	static_assert(Config::ALARM_TABLE_SIZE <= 127,
+	              "The alarm table can hold at most 127 entries");
+	static_assert(Config::CAPTURE_FIFO_SIZE <= 128 &&
+	                  (Config::CAPTURE_FIFO_SIZE &
+	                   (Config::CAPTURE_FIFO_SIZE - 1)) == 0,
+	              "The capture FIFO size must be a power of two");
+
+	/**
+	 * The current time as UNIX time stamp. This is incremented in update() and
+	 * recomputed from the registers whenever the time was written.
+	 */
+	struct EpochCache {
+		uint32_t now;
+		bool valid;
+	};
+
+	/**
+	 * Extended alarm table organised as binary min-heap. The entry with the
+	 * smallest time stamp is always at index zero.
+	 */
+	struct AlarmTable {
+		struct Entry {
+			uint32_t time;
+			uint8_t tag;
+		} heap[Config::ALARM_TABLE_SIZE ? Config::ALARM_TABLE_SIZE : 1];
+		uint8_t len;
+		uint8_t regs[5];   // Reg E8h-ECh
+		uint8_t command;   // Reg EDh
+		uint8_t status;    // Reg EEh
+	};
+
+	/**
+	 * Ring buffer holding captured event timestamps. The head is only written
+	 * by capture(), the tail only by the code reading the FIFO.
+	 */
+	struct Capture {
+		struct Entry {
+			uint32_t time;   // Cached UNIX time at the capture
+			uint8_t ticks;   // Ticks not yet committed by update()
+			uint16_t count;  // Sub-second timer count
+			bool stale;      // Time written, but not yet applied by update()
+		} fifo[Config::CAPTURE_FIFO_SIZE ? Config::CAPTURE_FIFO_SIZE : 1];
+		volatile uint8_t head;
+		volatile bool overflow;
+		uint8_t tail;
+		uint8_t regs[6];  // Reg E0h-E5h
+		uint8_t command;  // Reg E7h
+	};
+
+	/**
+	 * State of the fractional tick rate generator and of the PPS discipline.
+	 * All periods are in timer counts as 16.16 fixed point numbers.
+	 */
+	struct Rate {
+		uint32_t period;        // Estimated period of one second
+		uint16_t frac;          // Fractional accumulator
+		uint16_t current;       // Period of the current second
+		int16_t phase_adj;      // One-shot phase correction
+		volatile uint16_t pps_phase;    // Timer count at the last PPS edge
+		volatile bool pps_pending;      // Set by pps(), reset by update()
+		uint16_t pps_last_phase;        // Phase of the previous PPS edge
+		uint16_t pps_last_period;       // Period in which it occurred
+		uint8_t pps_age;        // Seconds since the last PPS edge
+		bool pps_valid;         // True if pps_last_phase is valid
+	};
+
+	/**
+	 * Countdown timer. The counter holds the number of seconds until the timer
+	 * expires.
+	 */
+	struct Timer {
+		uint8_t ctrl;     // Reg D8h
+		uint16_t reload;  // Reg D9h-DAh
+		uint16_t count;   // Reg DBh-DCh
+	};
+
+	/**
+	 * State of the drift estimator. The clock time is sampled right before the
+	 * host sets the time and compared to the new time in update().
+	 */
+	struct Drift {
+		uint32_t elapsed;  // Seconds since the last time the time was set
+		uint32_t old;      // Time stamp before the time was set
+		uint16_t phase;    // Timer count at which the timer was reset
+		bool pending;      // The time was set, evaluate in update()
+		bool valid;        // The time was set at least once
+	};
+
+	/**
+	 * Sub-second offset. The offset is the fraction of the second (in units
+	 * of 1/65536 s) that should have elapsed when the seconds register is
+	 * written; it is armed by writing the MSB. The registers cannot be
+	 * written in the same burst as 00h-06h, so the arm lasts until the end
+	 * of the next write message.
+	 */
+	struct Subsecond {
+		uint16_t offset;   // Reg D6h-D7h
+		uint16_t preload;  // Timer counts corresponding to the offset
+		bool armed;        // The offset applies to the next time set
+		bool hold;         // Armed in the current write message
+	};
+
+	/**
+	 * Command mailbox. The time is applied in a single step once the command
+	 * byte is written, so the host never observes an inconsistent mix of old
+	 * and new registers. The transfer is not shorter than a burst write of
+	 * the registers 00h-06h.
+	 */
+	struct Mailbox {
+		uint8_t regs[9];  // Reg F0h-F8h
+	};
+
+	/**
+	 * Registers and state of the optional extensions located at the upper end
+	 * of the address space. Disabled extensions are empty base classes and
+	 * do not occupy any memory; use ext() to access an extension.
+	 */
+	struct Extensions
+	    : Soft323xOptional<Timer, Config::TIMER>,
+	      Soft323xOptional<Mailbox, Config::MAILBOX>,
+	      Soft323xOptional<AlarmTable, bool(Config::ALARM_TABLE_SIZE)>,
+	      Soft323xOptional<Capture, bool(Config::CAPTURE_FIFO_SIZE)>,
+	      Soft323xOptional<EpochCache, HAS_EPOCH_CACHE>,
+	      Soft323xOptional<Rate, HAS_RATE>,
+	      Soft323xOptional<Drift, Config::DRIFT_ESTIMATOR>,
+	      Soft323xOptional<Subsecond, Config::SUBSECOND> {
+	} m_ext;
+
+	template <typename T, bool ENABLED>
+	static T &ext_get(Soft323xOptional<T, ENABLED> &o)
+	{
+		return o.get();
+	}
+
+	template <typename T, bool ENABLED>
+	static const T &ext_get(const Soft323xOptional<T, ENABLED> &o)
+	{
+		return o.get();
+	}
+
+	/**
+	 * Returns the state of the extension of type T.
+	 */
+	template <typename T>
+	T &ext()
+	{
+		return ext_get<T>(m_ext);
+	}
+
+	template <typename T>
+	const T &ext() const
+	{
+		return ext_get<T>(m_ext);
+	}
+
 	/**
 	 * Buffer containing the number of ticks that passed since the last call to
 	 * update().
 	 */
-#if __AVR__
-	volatile uint8_t m_ticks;
-#else
-	std::atomic<uint8_t> m_ticks;
-#endif
+	typename Config::Ticks m_ticks;
 
 	/**
 	 * Set to true if the date was modified. Correspondingly, we must check the
@@ -120,13 +655,53 @@ private:
 	 */
 	bool m_wrote_date;
 
+	/**
+	 * Results of the comparisons of the minutes, hours and day/date fields
+	 * with both alarms as computed by check_alarms(), see the MATCH_*
+	 * constants. Zero if the time or alarm registers were written since.
+	 */
+	uint8_t m_alarm_match;
+
+	/**
+	 * Calendar state derived from the month, year and century. Refreshed by
+	 * calendar_sync() when one of them changes, so increment_time() does not
+	 * have to decode them on every day rollover.
+	 */
+	struct Calendar {
+		uint8_t month_days;  // Number of days in the current month (BCD)
+		uint8_t century;     // Year divided by 100
+		bool leap;           // The current year is a leap year
+	} m_calendar;
+
+	/**
+	 * Most significant time field changed by increment_time(). Changes of the
+	 * month and year are reported as FIELD_DATE, since the alarms do not
+	 * depend on them.
+	 */
+	static constexpr uint8_t FIELD_SECONDS = 0U;
+	static constexpr uint8_t FIELD_MINUTES = 1U;
+	static constexpr uint8_t FIELD_HOURS = 2U;
+	static constexpr uint8_t FIELD_DATE = 3U;
+
+	static constexpr uint8_t MATCH_A1_MINUTES = 0x01;
+	static constexpr uint8_t MATCH_A1_HOURS = 0x02;
+	static constexpr uint8_t MATCH_A1_DAY_OR_DATE = 0x04;
+	static constexpr uint8_t MATCH_A1 = 0x07;
+	static constexpr uint8_t MATCH_A2_MINUTES = 0x08;
+	static constexpr uint8_t MATCH_A2_HOURS = 0x10;
+	static constexpr uint8_t MATCH_A2_DAY_OR_DATE = 0x20;
+	static constexpr uint8_t MATCH_A2 = 0x38;
+	static constexpr uint8_t MATCH_VALID = 0x80;
+
 	/**************************************************************************
 	 * Internal helper functions                                              *
 	 **************************************************************************/
 
 	/**
 	 * Atomically reads the content of the variable m_ticks and resets it to
-	 * zero.
+	 * zero. The ticks are added to the cached UNIX time in the same critical
+	 * section (if the tick policy uses one), so capture() always sees a
+	 * consistent state on AVRs.
 	 *
 	 * @return the value of m_ticks before it was reset to zero.
 	 */
@@ -134,46 +709,71 @@ private:
 	{
 		// Atomically read the number of queued ticks and reset the number of
 		// queued ticks to zero
-		uint8_t ticks;
-#if __AVR__
-		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-		{
-			ticks = m_ticks;
-			m_ticks = 0U;
-		}
-#else
-		ticks = m_ticks.exchange(0U);
-#endif
-		return ticks;
+		return m_ticks.consume([this](uint8_t ticks) {
+			if (HAS_EPOCH_CACHE) {
+				ext<EpochCache>().now += ticks;
+			}
+		});
+	}
+
+	/**
+	 * Atomically discards the queued ticks without applying them to the time
+	 * registers or the cached UNIX time, e.g. because the countdown chain is
+	 * reset.
+	 */
+	void atomic_discard_ticks() { m_ticks.consume([](uint8_t) {}); }
+
+	/**
+	 * Recomputes the cached calendar state from the month and year registers.
+	 */
+	void calendar_sync()
+	{
+		Calendar &c = m_calendar;
+		c.century = century();
+		c.leap = is_leap_year(c.century, year());
+		c.month_days = bcd_enc(days_in_month(month(), c.leap));
 	}
 
 	/**
 	 * Used internally by update() to make sure that the date/month/year
-	 * combination is valid.
+	 * combination is valid after the date registers were written.
 	 */
 	void canonicalise_date()
 	{
-		const uint8_t n_days = number_of_days(month(), century(), year());
+		calendar_sync();
 		m_regs.regs.date =
-		    bcd_canon(m_regs.regs.date, bcd_enc(1), bcd_enc(n_days));
+		    bcd_canon(m_regs.regs.date, bcd_enc(1), m_calendar.month_days);
 	}
 
+	/**
+	 * Calls the hooks of the probe policy on construction and destruction.
+	 */
+	template <uint8_t PATH>
+	struct ProbeScope {
+		ProbeScope() { Config::Probe::begin(PATH); }
+		~ProbeScope() { Config::Probe::end(PATH); }
+	};
+
 	/**
 	 * Used internally by update() to increment the time by one second.
+	 *
+	 * @return the most significant field that changed (one of FIELD_*).
 	 */
-	void increment_time()
+	uint8_t increment_time()
 	{
+		const ProbeScope<Soft323xProbePath::INCREMENT_TIME> probe;
+
 		// Shorthand for accessing the time registers
 		Registers &t = m_regs.regs;
 
 		// Increment seconds
 		if (!increment_bcd(t.seconds, MASK_SECONDS, bcd_enc(59))) {
-			return;
+			return FIELD_SECONDS;
 		}
 
 		// Increment minutes
 		if (!increment_bcd(t.minutes, MASK_MINUTES, bcd_enc(59))) {
-			return;
+			return FIELD_MINUTES;
 		}
 
 		// Increment the hour. Must distinguish between 12 and 24 hour mode.
@@ -183,128 +783,761 @@ private:
 				if ((t.hours & MASK_HOURS_12_HOURS) == bcd_enc(13)) {
 					// Overflow from 12 -> 1
 					t.hours = (t.hours & ~MASK_HOURS_12_HOURS) | bcd_enc(1);
-					return;
+					return FIELD_HOURS;
 				}
 				else if ((t.hours & MASK_HOURS_12_HOURS) == bcd_enc(12)) {
 					// Flip the PM/AM flag
 					t.hours = t.hours ^ BIT_HOUR_PM;
 					if (t.hours & BIT_HOUR_PM) {
 						// It just became noon. No further overflow happens.
-						return;
+						return FIELD_HOURS;
 					}
 					// It's 12 a.m. New day! Overflow the day and date.
 				}
 				else {
-					return;
+					return FIELD_HOURS;
 				}
 			}
 		}
 		else {
 			// We're in the 24 hours mode. This is sane people's land.
 			if (!increment_bcd(t.hours, MASK_HOURS_24_HOURS, bcd_enc(23))) {
-				return;
+				return FIELD_HOURS;
 			}
 		}
 
 		// A new day has started. Increment the day.
 		increment_bcd(t.day, MASK_DAY, bcd_enc(7), 1);
 
-		// Increment the date
-		{
-			const uint8_t n_days = number_of_days(month(), century(), year());
-			if (!increment_bcd(t.date, MASK_DATE, bcd_enc(n_days), 1)) {
-				return;
+		// Increment the date
+		if (!increment_bcd(t.date, MASK_DATE, m_calendar.month_days, 1)) {
+			return FIELD_DATE;
+		}
+
+		// Increment the month.
+		if (!increment_bcd(t.month, MASK_MONTH, bcd_enc(12), 1)) {
+			m_calendar.month_days =
+			    bcd_enc(days_in_month(month(), m_calendar.leap));
+			return FIELD_DATE;
+		}
+
+		// Increment the year. (Play Auld Lang Syne.)
+		if (!increment_bcd(t.year, MASK_YEAR, bcd_enc(99))) {
+			calendar_sync();
+			return FIELD_DATE;
+		}
+
+		// Huzzah! A new century hath begun. (Toggle the century bits.)
+		t.month = t.month ^ BIT_MONTH_CENTURY0;
+		if (!(t.month & BIT_MONTH_CENTURY0)) {
+			t.month = t.month ^ BIT_MONTH_CENTURY1;
+			if (!(t.month & BIT_MONTH_CENTURY1)) {
+				t.month = t.month ^ BIT_MONTH_CENTURY2;
+				// No more bits to overflow to. Sorry people of the future.
+			}
+		}
+		calendar_sync();
+		return FIELD_DATE;
+	}
+
+	/**
+	 * Returns true if the given alarm register matches the given time value
+	 * or if the alarm ignores this field (mask bit set).
+	 */
+	static constexpr bool alarm_field_match(uint8_t alarm, uint8_t mask,
+	                                        uint8_t value)
+	{
+		return (alarm & BIT_ALARM_MODE) || ((alarm & mask) == value);
+	}
+
+	/**
+	 * Same as alarm_field_match() for the day/date alarm registers, which
+	 * either compare the day of the week or the date.
+	 */
+	static constexpr bool alarm_day_or_date_match(uint8_t alarm, uint8_t day,
+	                                              uint8_t date)
+	{
+		return (alarm & BIT_ALARM_IS_DAY)
+		           ? alarm_field_match(alarm, MASK_DAY, day & MASK_DAY)
+		           : alarm_field_match(alarm, MASK_DATE, date & MASK_DATE);
+	}
+
+	/**
+	 * Checks whether any of the given alarms has expired; if yes, sets the
+	 * corresponding flag in the control register. This must be called exactly
+	 * once per second for Alarm 1 to work correctly.
+	 *
+	 * The comparisons of the minutes, hours and day/date fields are cached in
+	 * m_alarm_match and only the fields up to the given one are compared
+	 * again. In the common case only the seconds changed; then only the
+	 * seconds of Alarm 1 are compared and Alarm 2, which can only match at
+	 * the full minute, is skipped.
+	 *
+	 * @param changed is the most significant field that changed since the
+	 * last call, as returned by increment_time().
+	 */
+	void check_alarms(uint8_t changed = FIELD_DATE)
+	{
+		const ProbeScope<Soft323xProbePath::CHECK_ALARMS> probe;
+
+		// Shorthand for the registers
+		Registers &t = m_regs.regs;
+
+		// Compare all fields if the registers were written
+		uint8_t m = m_alarm_match;
+		if (!(m & MATCH_VALID)) {
+			changed = FIELD_DATE;
+		}
+		if (changed >= FIELD_MINUTES) {
+			const uint8_t mm = t.minutes & MASK_MINUTES;
+			m = (m & ~(MATCH_A1_MINUTES | MATCH_A2_MINUTES)) |
+			    (alarm_field_match(t.alarm_1_minutes, MASK_MINUTES, mm)
+			         ? MATCH_A1_MINUTES
+			         : 0U) |
+			    (alarm_field_match(t.alarm_2_minutes, MASK_MINUTES, mm)
+			         ? MATCH_A2_MINUTES
+			         : 0U);
+		}
+		if (changed >= FIELD_HOURS) {
+			const uint8_t hh = t.hours & 0x7F;
+			m = (m & ~(MATCH_A1_HOURS | MATCH_A2_HOURS)) |
+			    (alarm_field_match(t.alarm_1_hours, 0x7F, hh) ? MATCH_A1_HOURS
+			                                                  : 0U) |
+			    (alarm_field_match(t.alarm_2_hours, 0x7F, hh) ? MATCH_A2_HOURS
+			                                                  : 0U);
+		}
+		if (changed >= FIELD_DATE) {
+			m = (m & ~(MATCH_A1_DAY_OR_DATE | MATCH_A2_DAY_OR_DATE)) |
+			    (alarm_day_or_date_match(t.alarm_1_day_or_date, t.day, t.date)
+			         ? MATCH_A1_DAY_OR_DATE
+			         : 0U) |
+			    (alarm_day_or_date_match(t.alarm_2_day_or_date, t.day, t.date)
+			         ? MATCH_A2_DAY_OR_DATE
+			         : 0U);
+		}
+		m_alarm_match = m | MATCH_VALID;
+
+		// Update the "alarm fired" flags in the control registers. Alarm 2
+		// only matches at the full minute, i.e. if the minutes changed.
+		const uint8_t ss = t.seconds & MASK_SECONDS;
+		if (!(t.ctrl_2 & BIT_CTRL_2_A1F) && (m & MATCH_A1) == MATCH_A1 &&
+		    alarm_field_match(t.alarm_1_seconds, MASK_SECONDS, ss)) {
+			t.ctrl_2 = t.ctrl_2 | BIT_CTRL_2_A1F;
+		}
+		if (changed >= FIELD_MINUTES && ss == 0U &&
+		    !(t.ctrl_2 & BIT_CTRL_2_A2F) && (m & MATCH_A2) == MATCH_A2) {
+			t.ctrl_2 = t.ctrl_2 | BIT_CTRL_2_A2F;
+		}
+	}
+
+	/**
+	 * Encodes the given hour (0-23) either in the 24 hour or in the 12 hour
+	 * format.
+	 */
+	static constexpr uint8_t encode_hours(uint8_t hours, bool is_12_hour)
+	{
+		return (!is_12_hour)
+		           ? bcd_enc(hours)
+		           : (BIT_HOUR_12_HOURS | ((hours >= 12U) ? BIT_HOUR_PM : 0U) |
+		              bcd_enc((hours == 0U || hours == 12U)
+		                          ? 12U
+		                          : ((hours > 12U) ? (hours - 12U) : hours)));
+	}
+
+	/**
+	 * Executes the command written to the mailbox command register.
+	 *
+	 * @param cmd is the command that should be executed.
+	 * @return the actions the caller should take.
+	 */
+	uint8_t mailbox_execute(uint8_t cmd)
+	{
+		uint8_t *mb = ext<Mailbox>().regs;
+		uint8_t res = 0U;
+		bool ok = false;
+		switch (cmd) {
+			case MAILBOX_CMD_SET_EPOCH: {
+				uint64_t t = 0U;
+				for (uint8_t i = 8U; i > 0U; i--) {
+					t = (t << 8U) | mb[i - 1U];
+				}
+				if (Config::DRIFT_ESTIMATOR) {
+					drift_begin();
+				}
+				if (Config::SUBSECOND) {
+					subsecond_begin();
+				}
+				ok = set_epoch(int64_t(t));
+				break;
+			}
+			case MAILBOX_CMD_SET_TIME:
+				// Write the register image using the usual I2C semantics and
+				// validate the date right away
+				for (uint8_t i = REG_SECONDS; i <= REG_YEAR; i++) {
+					i2c_write(i, mb[i - REG_SECONDS]);
+				}
+				canonicalise_date();
+				m_wrote_date = false;
+				ok = true;
+				break;
+		}
+		if (ok) {
+			res |= ACTION_RESET_TIMER;
+		}
+		mb[REG_MAILBOX_COMMAND - REG_MAILBOX] =
+		    ok ? CMD_STATUS_DONE : CMD_STATUS_ERROR;
+		return res;
+	}
+
+	/**
+	 * Recomputes the cached UNIX time stamp if the time registers were
+	 * written.
+	 */
+	void epoch_cache_sync()
+	{
+		EpochCache &c = ext<EpochCache>();
+		if (c.valid) {
+			return;
+		}
+		const int64_t t = epoch();
+		const uint32_t now =
+		    (t < 0) ? 0U : ((t > 0xFFFFFFFFLL) ? 0xFFFFFFFFUL : t);
+#if __AVR__
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#endif
+		{
+			c.now = now;
+			c.valid = true;
+		}
+
+		// Events captured after the write happened at the new time
+		if (Config::CAPTURE_FIFO_SIZE) {
+			Capture &cap = ext<Capture>();
+			for (uint8_t i = cap.tail; i != cap.head; i++) {
+				typename Capture::Entry &e =
+				    cap.fifo[i & (Config::CAPTURE_FIFO_SIZE - 1U)];
+				if (e.stale) {
+					e.time = now;
+					e.stale = false;
+				}
+			}
+		}
+	}
+
+	/**
+	 * Returns true if the entry at the top of the alarm table has expired.
+	 */
+	bool alarm_table_expired() const
+	{
+		const AlarmTable &a = ext<AlarmTable>();
+		return a.len > 0U && a.heap[0].time <= ext<EpochCache>().now;
+	}
+
+	/**
+	 * Inserts a new entry into the alarm table in O(log n).
+	 *
+	 * @return false if the alarm table is full.
+	 */
+	bool alarm_table_insert(uint32_t time, uint8_t tag)
+	{
+		AlarmTable &a = ext<AlarmTable>();
+		if (a.len >= Config::ALARM_TABLE_SIZE) {
+			return false;
+		}
+
+		// Move parents down until the new entry can be placed
+		uint8_t i = a.len++;
+		while (i > 0U) {
+			const uint8_t parent = (i - 1U) >> 1U;
+			if (a.heap[parent].time <= time) {
+				break;
+			}
+			a.heap[i] = a.heap[parent];
+			i = parent;
+		}
+		a.heap[i].time = time;
+		a.heap[i].tag = tag;
+		return true;
+	}
+
+	/**
+	 * Removes the entry at the top of the alarm table in O(log n).
+	 *
+	 * @return false if the alarm table is empty.
+	 */
+	bool alarm_table_pop()
+	{
+		AlarmTable &a = ext<AlarmTable>();
+		if (!Config::ALARM_TABLE_SIZE || a.len == 0U) {
+			return false;
+		}
+
+		// Move the smaller child up until the last entry can be placed
+		const typename AlarmTable::Entry last = a.heap[--a.len];
+		uint8_t i = 0U;
+		while (true) {
+			uint8_t child = (i << 1U) + 1U;
+			if (child >= a.len) {
+				break;
+			}
+			if (child + 1U < a.len &&
+			    a.heap[child + 1U].time < a.heap[child].time) {
+				child++;
+			}
+			if (last.time <= a.heap[child].time) {
+				break;
+			}
+			a.heap[i] = a.heap[child];
+			i = child;
+		}
+		a.heap[i] = last;
+		return true;
+	}
+
+	/**
+	 * Copies the given alarm table entry to the time and tag registers.
+	 */
+	void alarm_table_show(const typename AlarmTable::Entry &e)
+	{
+		uint8_t *regs = ext<AlarmTable>().regs;
+		for (uint8_t i = 0U; i < 4U; i++) {
+			regs[i] = uint8_t(e.time >> (8U * i));
+		}
+		regs[REG_ALARM_TABLE_TAG - REG_ALARM_TABLE] = e.tag;
+	}
+
+	/**
+	 * Executes the command written to the alarm table command register.
+	 *
+	 * @return true if the command was successful.
+	 */
+	bool alarm_table_execute(uint8_t cmd)
+	{
+		AlarmTable &a = ext<AlarmTable>();
+		switch (cmd) {
+			case ALARM_TABLE_CMD_INSERT: {
+				uint32_t time = 0U;
+				for (uint8_t i = 4U; i > 0U; i--) {
+					time = (time << 8U) | a.regs[i - 1U];
+				}
+				return alarm_table_insert(
+				    time, a.regs[REG_ALARM_TABLE_TAG - REG_ALARM_TABLE]);
+			}
+			case ALARM_TABLE_CMD_POP:
+				if (a.len == 0U) {
+					return false;
+				}
+				alarm_table_show(a.heap[0]);
+				return alarm_table_pop();
+			case ALARM_TABLE_CMD_PEEK:
+				if (a.len == 0U) {
+					return false;
+				}
+				alarm_table_show(a.heap[0]);
+				return true;
+			case ALARM_TABLE_CMD_CLEAR:
+				a.len = 0U;
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	/**
+	 * Processes the last PPS edge. Estimates the length of a second in timer
+	 * counts from the phase difference between two PPS edges and feeds it into
+	 * a first-order low-pass filter. Additionally, a fraction of the phase
+	 * error is applied to the next second, which aligns the ticks with the PPS
+	 * edges and cancels the residual frequency error in the long run. If the
+	 * PPS signal disappears, the last estimate is kept (holdover).
+	 *
+	 * @param ticks is the number of ticks since the last call.
+	 */
+	void pps_process(uint8_t ticks)
+	{
+		Rate &r = ext<Rate>();
+
+		// Invalidate the last phase if there was no PPS edge for too long
+		r.pps_age = (r.pps_age > 255U - ticks) ? 255U : (r.pps_age + ticks);
+		if (r.pps_age > PPS_TIMEOUT) {
+			r.pps_valid = false;
+		}
+		if (!r.pps_pending) {
+			return;
+		}
+
+		// Fetch the phase of the new PPS edge
+		uint16_t phase, period;
+#if __AVR__
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#endif
+		{
+			phase = r.pps_phase;
+			period = r.current;
+			r.pps_pending = false;
+		}
+
+		// Signed phase error relative to the beginning of the second
+		const int16_t err = (phase > (period >> 1U))
+		                        ? int16_t(phase - period)
+		                        : int16_t(phase);
+
+		// Measure the length of the last second and update the estimate
+		if (r.pps_valid) {
+			const uint16_t last = r.pps_last_period;
+			int32_t d = int32_t(phase) - int32_t(r.pps_last_phase);
+			if (d > int32_t(last >> 1U)) {
+				d -= last;
+			}
+			else if (d < -int32_t(last >> 1U)) {
+				d += last;
+			}
+			const int32_t measured = (int32_t(last) + d) << 16;
+			r.period += (measured - int32_t(r.period)) >> PPS_FREQ_GAIN;
+		}
+		r.phase_adj = (err + (1 << (PPS_PHASE_GAIN - 1U))) >> PPS_PHASE_GAIN;
+		r.pps_last_phase = phase;
+		r.pps_last_period = period;
+		r.pps_age = 0U;
+		r.pps_valid = true;
+	}
+
+	/**
+	 * Executes the command written to the capture command register.
+	 *
+	 * @return true if the command was successful.
+	 */
+	bool capture_execute(uint8_t cmd)
+	{
+		Capture &c = ext<Capture>();
+		switch (cmd) {
+			case CAPTURE_CMD_POP: {
+				if (c.head == c.tail) {
+					return false;
+				}
+				const typename Capture::Entry &e =
+				    c.fifo[c.tail & (Config::CAPTURE_FIFO_SIZE - 1U)];
+				if (e.stale) {
+					return false;  // Time not known before update()
+				}
+				const uint32_t time = e.time + e.ticks;
+				for (uint8_t i = 0U; i < 4U; i++) {
+					c.regs[i] = uint8_t(time >> (8U * i));
+				}
+				c.regs[4] = uint8_t(e.count);
+				c.regs[5] = uint8_t(e.count >> 8U);
+				c.tail = c.tail + 1U;
+				return true;
+			}
+			case CAPTURE_CMD_CLEAR:
+				c.tail = c.head;
+				c.overflow = false;
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	/**
+	 * Counts the timer down by the given number of seconds. The cost does not
+	 * depend on the number of seconds.
+	 */
+	void timer_process(uint32_t n)
+	{
+		Timer &t = ext<Timer>();
+		if (!(t.ctrl & BIT_TIMER_TE) || n == 0U) {
+			return;
+		}
+		if (n < t.count) {
+			t.count = uint16_t(t.count - n);
+			return;
+		}
+
+		// The timer expired; reload it if periodic mode is selected. If the
+		// reload value is smaller than the number of seconds, the timer
+		// expired multiple times.
+		n -= t.count;
+		t.ctrl = t.ctrl | BIT_TIMER_TF;
+		if (!(t.ctrl & BIT_TIMER_TP) || t.reload == 0U) {
+			t.ctrl = t.ctrl & ~BIT_TIMER_TE;
+			t.count = 0U;
+			return;
+		}
+		if (n >= t.reload) {
+			n %= t.reload;
+		}
+		t.count = uint16_t(t.reload - n);
+	}
+
+	/**
+	 * Returns the number of days between 1900/01/01 and the current date.
+	 * Does not use division.
+	 */
+	uint32_t days_since_1900() const
+	{
+		// Count the leap years before the given year as y/4 - y/100 + y/400.
+		// y/100 is the century, except in the first year of a century.
+		const uint8_t c = century();
+		const uint16_t y = uint16_t(c) * 100U + year() - 1U;
+		const uint8_t yc = (year() == 0U) ? (c - 1U) : c;
+		uint32_t days = 365UL * (y - 1899U) + ((y >> 2U) - yc + (yc >> 2U)) -
+		                (1899U / 4U - 1899U / 100U + 1899U / 400U);
+		for (uint8_t m = 1U; m < month(); m++) {
+			days += number_of_days(m, c, year());
+		}
+		return days + date() - 1U;
+	}
+
+	/**
+	 * Returns the current UNIX time modulo 2^32, which is exact between 1970
+	 * and 2106. Sufficient for time differences, and avoids 64-bit
+	 * arithmetic on 8-bit targets.
+	 */
+	uint32_t epoch32() const
+	{
+		const uint32_t secs = uint32_t(hours()) * 3600UL +
+		                      uint16_t(minutes()) * 60U + seconds();
+		return days_since_1900() * 86400UL + secs - uint32_t(EPOCH_1900);
+	}
+
+	/**
+	 * Records the current time right before the host sets the time. Only the
+	 * first write in a transaction is recorded.
+	 */
+	void drift_begin()
+	{
+		Drift &d = ext<Drift>();
+		if (d.pending) {
+			return;
+		}
+
+		// Ticks that were not yet committed are discarded by the write
+		const uint8_t ticks = m_ticks.load();
+		d.old = epoch32() + ticks;
+		d.elapsed += ticks;
+		d.phase = ext<Rate>().current >> 1U;  // Unknown, assume half a second
+		d.pending = true;
+	}
+
+	/**
+	 * Compares the time recorded by drift_begin() to the time written by the
+	 * host. The difference, divided by the time since the previous time set,
+	 * is the relative rate error of the clock; the estimated period is moved
+	 * towards the corrected value by a first-order low-pass filter. Intervals
+	 * shorter than DRIFT_MIN_INTERVAL are too imprecise, differences larger
+	 * than 1/2^DRIFT_MAX_ERROR of the interval are deliberate changes of the
+	 * time rather than drift; both are ignored.
+	 */
+	void drift_evaluate()
+	{
+		Drift &d = ext<Drift>();
+		if (!d.pending) {
+			return;
+		}
+		const uint32_t elapsed = d.elapsed;
+		const bool valid = d.valid;
+		d.pending = false;
+		d.valid = true;
+		d.elapsed = 0U;
+		if (!valid || elapsed < DRIFT_MIN_INTERVAL) {
+			return;
+		}
+
+		// Error in timer counts, positive if the clock was running fast. The
+		// new second starts at the preloaded timer count. Long intervals are
+		// scaled down along with the error to keep the arithmetic in 32 bits;
+		// the remaining resolution is still below 1 ppm.
+		Rate &r = ext<Rate>();
+		int32_t ds = int32_t(d.old - epoch32());
+		int32_t frac = int32_t(d.phase) - int32_t(timer_preload());
+		uint32_t e = elapsed;
+		uint16_t phase = d.phase;
+		while (e >= (1UL << 20U)) {
+			e >>= 1U;
+			ds >>= 1;
+			frac >>= 1;
+			phase >>= 1U;
+		}
+		if (((ds < 0) ? -ds : ds) > int32_t(e >> DRIFT_MAX_ERROR) + 1) {
+			return;  // Also keeps the error below 2^31
+		}
+		const int32_t err = ds * int32_t(r.current) + frac;
+		const uint32_t mag = (err < 0) ? uint32_t(-err) : uint32_t(err);
+
+		// Compare against span / 2^DRIFT_MAX_ERROR with span = e * current +
+		// phase, split to avoid the overflow of the product
+		constexpr uint8_t mask = (1U << DRIFT_MAX_ERROR) - 1U;
+		const uint32_t limit = (e >> DRIFT_MAX_ERROR) * r.current +
+		                       (((e & mask) * r.current + phase) >>
+		                        DRIFT_MAX_ERROR);
+		if (mag > limit) {
+			return;
+		}
+
+		// mag * 65536 / e, in two steps with e < 2^20
+		const uint32_t q = mag / e, rem = mag % e;
+		const uint32_t corr = (q << 16U) + (((rem << 12U) / e) << 4U);
+		r.period += (err < 0) ? -int32_t(corr >> DRIFT_GAIN)
+		                      : int32_t(corr >> DRIFT_GAIN);
+	}
+
+	/**
+	 * Counts the seconds since the last time the host set the time.
+	 */
+	void drift_count(uint32_t n)
+	{
+		Drift &d = ext<Drift>();
+		if (d.valid) {
+			d.elapsed = (d.elapsed > 0xFFFFFFFFUL - n) ? 0xFFFFFFFFUL
+			                                           : (d.elapsed + n);
+		}
+	}
+
+	/**
+	 * Converts an armed sub-second offset into the timer count at which the
+	 * second timer restarts when the host sets the time. Without an armed
+	 * offset the timer restarts at zero.
+	 */
+	void subsecond_begin()
+	{
+		Subsecond &s = ext<Subsecond>();
+		s.preload = s.armed ? uint16_t((uint32_t(s.offset) *
+		                                ext<Rate>().current) >> 16U)
+		                    : 0U;
+		s.armed = false;
+	}
+
+	/**
+	 * Reads from the extension registers.
+	 */
+	uint8_t ext_read(uint8_t addr) const
+	{
+		if (Config::SUBSECOND && addr >= REG_SUBSECOND &&
+		    addr <= REG_SUBSECOND + 1U) {
+			return uint8_t(ext<Subsecond>().offset >>
+			               ((addr - REG_SUBSECOND) * 8U));
+		}
+		if (Config::TIMER && addr >= REG_TIMER && addr <= REG_TIMER_COUNT + 1U) {
+			const Timer &t = ext<Timer>();
+			switch (addr) {
+				case REG_TIMER:
+					return t.ctrl;
+				case REG_TIMER_RELOAD:
+					return uint8_t(t.reload);
+				case REG_TIMER_RELOAD + 1U:
+					return uint8_t(t.reload >> 8U);
+				case REG_TIMER_COUNT:
+					return uint8_t(t.count);
+				default:
+					return uint8_t(t.count >> 8U);
 			}
 		}
-
-		// Increment the month.
-		if (!increment_bcd(t.month, MASK_MONTH, bcd_enc(12), 1)) {
-			return;
+		if (Config::CAPTURE_FIFO_SIZE && addr >= REG_CAPTURE &&
+		    addr <= REG_CAPTURE_COMMAND) {
+			const Capture &c = ext<Capture>();
+			switch (addr) {
+				case REG_CAPTURE_COUNT:
+					return uint8_t(c.head - c.tail) |
+					       (c.overflow ? BIT_CAPTURE_OVF : 0U);
+				case REG_CAPTURE_COMMAND:
+					return c.command;
+				default:
+					return c.regs[addr - REG_CAPTURE];
+			}
 		}
-
-		// Increment the year. (Play Auld Lang Syne.)
-		if (!increment_bcd(t.year, MASK_YEAR, bcd_enc(99))) {
-			return;
+		if (Config::MAILBOX && addr >= REG_MAILBOX &&
+		    addr <= REG_MAILBOX_COMMAND) {
+			return ext<Mailbox>().regs[addr - REG_MAILBOX];
 		}
-
-		// Huzzah! A new century hath begun. (Toggle the century bits.)
-		t.month = t.month ^ BIT_MONTH_CENTURY0;
-		if (!(t.month & BIT_MONTH_CENTURY0)) {
-			t.month = t.month ^ BIT_MONTH_CENTURY1;
-			if (!(t.month & BIT_MONTH_CENTURY1)) {
-				t.month = t.month ^ BIT_MONTH_CENTURY2;
-				// No more bits to overflow to. Sorry people of the future.
+		if (Config::ALARM_TABLE_SIZE && addr >= REG_ALARM_TABLE &&
+		    addr <= REG_ALARM_TABLE_COUNT) {
+			const AlarmTable &a = ext<AlarmTable>();
+			switch (addr) {
+				case REG_ALARM_TABLE_COMMAND:
+					return a.command;
+				case REG_ALARM_TABLE_STATUS:
+					return (alarm_table_expired() ? BIT_ALARM_TABLE_ATF : 0U) |
+					       a.status;
+				case REG_ALARM_TABLE_COUNT:
+					return a.len;
+				default:
+					return a.regs[addr - REG_ALARM_TABLE];
 			}
 		}
+		return 0U;
 	}
 
 	/**
-	 * Checks whether any of the given alarms has expired; if yes, sets the
-	 * corresponding flag in the control register. This must be called exactly
-	 * once per second for Alarm 1 to work correctly. Note: This code relies on
-	 * the optimizer to rearange the computations to actually happen when
-	 * assigning values to the local variables "alarm1" and "alarm2".
+	 * Writes to the extension registers.
 	 */
-	void check_alarms()
+	uint8_t ext_write(uint8_t addr, uint8_t value)
 	{
-		// Shorthand for the registers
-		Registers &t = m_regs.regs;
-
-		// Skip all the computation if the alarm flags are already set
-		const bool a1f = t.ctrl_2 & BIT_CTRL_2_A1F;
-		const bool a2f = t.ctrl_2 & BIT_CTRL_2_A2F;
-
-		// Read the alarm flags
-		const bool a1m1 = !!(t.alarm_1_seconds & BIT_ALARM_MODE);
-		const bool a1m2 = !!(t.alarm_1_minutes & BIT_ALARM_MODE);
-		const bool a1m3 = !!(t.alarm_1_hours & BIT_ALARM_MODE);
-		const bool a1m4 = !!(t.alarm_1_day_or_date & BIT_ALARM_MODE);
-		const bool a1dy = !!(t.alarm_1_day_or_date & BIT_ALARM_IS_DAY);
-
-		const bool a2m1 = !!(t.alarm_2_minutes & BIT_ALARM_MODE);
-		const bool a2m2 = !!(t.alarm_2_hours & BIT_ALARM_MODE);
-		const bool a2m3 = !!(t.alarm_2_day_or_date & BIT_ALARM_MODE);
-		const bool a2dy = !!(t.alarm_2_day_or_date & BIT_ALARM_IS_DAY);
-
-		// Apply the correct masks to the time values
-		const uint8_t ss = t.seconds & MASK_SECONDS;
-		const uint8_t mm = t.minutes & MASK_MINUTES;
-		const uint8_t hh = t.hours & 0x7F;
-		const uint8_t dy = t.day & MASK_DAY;
-		const uint8_t dt = t.date & MASK_DATE;
-
-		// Apply the correct masks to the alarm values
-		const uint8_t a1_ss = t.alarm_1_seconds & MASK_SECONDS;
-		const uint8_t a1_mm = t.alarm_1_minutes & MASK_MINUTES;
-		const uint8_t a1_hh = t.alarm_1_hours & 0x7F;
-		const uint8_t a1_dy_dt = a1dy ? (t.alarm_1_day_or_date & MASK_DAY)
-		                              : (t.alarm_1_day_or_date & MASK_DATE);
-
-		const uint8_t a2_mm = t.alarm_2_minutes & MASK_MINUTES;
-		const uint8_t a2_hh = t.alarm_2_hours & 0x7F;
-		const uint8_t a2_dy_dt = a2dy ? (t.alarm_2_day_or_date & MASK_DAY)
-		                              : (t.alarm_2_day_or_date & MASK_DATE);
-
-		// Compute whether the alarm has triggered
-		const bool alarm1 = (!a1f) && (a1m1 || (!a1m1 && (a1_ss == ss))) &&
-		                    (a1m2 || (!a1m2 && (a1_mm == mm))) &&
-		                    (a1m3 || (!a1m3 && (a1_hh == hh))) &&
-		                    (a1m4 || (!a1m4 && ((a1dy ? dy : dt) == a1_dy_dt)));
-
-		const bool alarm2 = (!a2f) && (ss == 0) &&
-		                    (a2m1 || (!a2m1 && (a2_mm == mm))) &&
-		                    (a2m2 || (!a2m2 && (a2_hh == hh))) &&
-		                    (a2m3 || (!a2m3 && ((a2dy ? dy : dt) == a2_dy_dt)));
-
-		// TODO: Interrupt handling
-
-		// Update the "alarm fired" flags in the control registers
-		if (alarm1) {
-			t.ctrl_2 = t.ctrl_2 | BIT_CTRL_2_A1F;
+		if (Config::SUBSECOND && addr == REG_SUBSECOND) {
+			Subsecond &s = ext<Subsecond>();
+			s.offset = (s.offset & 0xFF00U) | value;
 		}
-		if (alarm2) {
-			t.ctrl_2 = t.ctrl_2 | BIT_CTRL_2_A2F;
+		if (Config::SUBSECOND && addr == REG_SUBSECOND + 1U) {
+			Subsecond &s = ext<Subsecond>();
+			s.offset = (s.offset & 0x00FFU) | (uint16_t(value) << 8U);
+			s.armed = true;
+			s.hold = true;
+		}
+		if (Config::TIMER && addr >= REG_TIMER && addr <= REG_TIMER_COUNT + 1U) {
+			Timer &t = ext<Timer>();
+			switch (addr) {
+				case REG_TIMER:
+					// Starting the timer loads the counter; TF can only be
+					// set to zero
+					if ((value & BIT_TIMER_TE) && !(t.ctrl & BIT_TIMER_TE)) {
+						t.count = t.reload;
+					}
+					t.ctrl = (value & (BIT_TIMER_TE | BIT_TIMER_TIE |
+					                   BIT_TIMER_TP)) |
+					         (value & t.ctrl & BIT_TIMER_TF);
+					break;
+				case REG_TIMER_RELOAD:
+					t.reload = (t.reload & 0xFF00U) | value;
+					break;
+				case REG_TIMER_RELOAD + 1U:
+					t.reload = (t.reload & 0x00FFU) | (uint16_t(value) << 8U);
+					break;
+				default:
+					// The counter is read-only
+					break;
+			}
+		}
+		if (Config::CAPTURE_FIFO_SIZE && addr == REG_CAPTURE_COMMAND) {
+			ext<Capture>().command =
+			    capture_execute(value) ? CMD_STATUS_DONE : CMD_STATUS_ERROR;
+		}
+		if (Config::MAILBOX && addr >= REG_MAILBOX &&
+		    addr <= REG_MAILBOX_COMMAND) {
+			if (addr == REG_MAILBOX_COMMAND) {
+				return mailbox_execute(value);
+			}
+			ext<Mailbox>().regs[addr - REG_MAILBOX] = value;
 		}
+		if (Config::ALARM_TABLE_SIZE && addr >= REG_ALARM_TABLE &&
+		    addr <= REG_ALARM_TABLE_COUNT) {
+			AlarmTable &a = ext<AlarmTable>();
+			switch (addr) {
+				case REG_ALARM_TABLE_COMMAND:
+					a.command = alarm_table_execute(value) ? CMD_STATUS_DONE
+					                                       : CMD_STATUS_ERROR;
+					break;
+				case REG_ALARM_TABLE_STATUS:
+					// The ATF flag is read-only
+					a.status = value & BIT_ALARM_TABLE_ATIE;
+					break;
+				case REG_ALARM_TABLE_COUNT:
+					// Read-only
+					break;
+				default:
+					a.regs[addr - REG_ALARM_TABLE] = value;
+					break;
+			}
+		}
+		return 0U;
 	}
 
 public:
@@ -468,6 +1701,18 @@ public:
 	 */
 	static constexpr uint8_t number_of_days(uint8_t month, uint8_t century,
 	                                        uint8_t year)
+	{
+		return days_in_month(month, is_leap_year(century, year));
+	}
+
+	/**
+	 * Same as number_of_days(), but with the leap year rule already applied.
+	 *
+	 * @param month is the month for which the number of days should be
+	 * computed.
+	 * @param leap is true if the month is in a leap year.
+	 */
+	static constexpr uint8_t days_in_month(uint8_t month, bool leap)
 	{
 		// Courtesy of the knuckle rule. See
 		// https://happyhooligans.ca/trick-to-remember-which-months-have-31-days/
@@ -476,7 +1721,7 @@ public:
 			case 1:
 				return 31;
 			case 2:
-				if (is_leap_year(century, year)) {
+				if (leap) {
 					return 29;
 				}
 				return 28;
@@ -505,6 +1750,89 @@ public:
 		}
 	}
 
+	/**************************************************************************
+	 * SMBus packet error checking                                            *
+	 **************************************************************************/
+
+	/**
+	 * Updates the SMBus packet error code (PEC), a CRC-8 with the polynomial
+	 * x^8 + x^2 + x + 1, with the given byte. The PEC must be computed over
+	 * all bytes of a transaction, including the address bytes. It starts at
+	 * zero; feeding a correct PEC byte to the PEC results in zero.
+	 *
+	 * @param pec is the PEC computed over all previous bytes.
+	 * @param data is the byte that should be added to the PEC.
+	 * @return the updated PEC.
+	 */
+	static uint8_t pec_update(uint8_t pec, uint8_t data)
+	{
+#if SOFT323X_PEC_NIBBLE_TABLE
+		static const uint8_t table[16] SOFT323X_PROGMEM = {
+		    0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15,
+		    0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D};
+		pec = pec ^ data;
+		pec = (pec << 4U) ^ SOFT323X_PGM_READ(table[pec >> 4U]);
+		pec = (pec << 4U) ^ SOFT323X_PGM_READ(table[pec >> 4U]);
+		return pec;
+#else
+		static const uint8_t table[256] SOFT323X_PROGMEM = {
+		    0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15,
+		    0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
+		    0x70, 0x77, 0x7E, 0x79, 0x6C, 0x6B, 0x62, 0x65,
+		    0x48, 0x4F, 0x46, 0x41, 0x54, 0x53, 0x5A, 0x5D,
+		    0xE0, 0xE7, 0xEE, 0xE9, 0xFC, 0xFB, 0xF2, 0xF5,
+		    0xD8, 0xDF, 0xD6, 0xD1, 0xC4, 0xC3, 0xCA, 0xCD,
+		    0x90, 0x97, 0x9E, 0x99, 0x8C, 0x8B, 0x82, 0x85,
+		    0xA8, 0xAF, 0xA6, 0xA1, 0xB4, 0xB3, 0xBA, 0xBD,
+		    0xC7, 0xC0, 0xC9, 0xCE, 0xDB, 0xDC, 0xD5, 0xD2,
+		    0xFF, 0xF8, 0xF1, 0xF6, 0xE3, 0xE4, 0xED, 0xEA,
+		    0xB7, 0xB0, 0xB9, 0xBE, 0xAB, 0xAC, 0xA5, 0xA2,
+		    0x8F, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9D, 0x9A,
+		    0x27, 0x20, 0x29, 0x2E, 0x3B, 0x3C, 0x35, 0x32,
+		    0x1F, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0D, 0x0A,
+		    0x57, 0x50, 0x59, 0x5E, 0x4B, 0x4C, 0x45, 0x42,
+		    0x6F, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7D, 0x7A,
+		    0x89, 0x8E, 0x87, 0x80, 0x95, 0x92, 0x9B, 0x9C,
+		    0xB1, 0xB6, 0xBF, 0xB8, 0xAD, 0xAA, 0xA3, 0xA4,
+		    0xF9, 0xFE, 0xF7, 0xF0, 0xE5, 0xE2, 0xEB, 0xEC,
+		    0xC1, 0xC6, 0xCF, 0xC8, 0xDD, 0xDA, 0xD3, 0xD4,
+		    0x69, 0x6E, 0x67, 0x60, 0x75, 0x72, 0x7B, 0x7C,
+		    0x51, 0x56, 0x5F, 0x58, 0x4D, 0x4A, 0x43, 0x44,
+		    0x19, 0x1E, 0x17, 0x10, 0x05, 0x02, 0x0B, 0x0C,
+		    0x21, 0x26, 0x2F, 0x28, 0x3D, 0x3A, 0x33, 0x34,
+		    0x4E, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5C, 0x5B,
+		    0x76, 0x71, 0x78, 0x7F, 0x6A, 0x6D, 0x64, 0x63,
+		    0x3E, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2C, 0x2B,
+		    0x06, 0x01, 0x08, 0x0F, 0x1A, 0x1D, 0x14, 0x13,
+		    0xAE, 0xA9, 0xA0, 0xA7, 0xB2, 0xB5, 0xBC, 0xBB,
+		    0x96, 0x91, 0x98, 0x9F, 0x8A, 0x8D, 0x84, 0x83,
+		    0xDE, 0xD9, 0xD0, 0xD7, 0xC2, 0xC5, 0xCC, 0xCB,
+		    0xE6, 0xE1, 0xE8, 0xEF, 0xFA, 0xFD, 0xF4, 0xF3};
+		return SOFT323X_PGM_READ(table[pec ^ data]);
+#endif
+	}
+
+	/**
+	 * Returns true if the given address is the last address of a block of
+	 * registers. When packet error checking is used, reads are terminated
+	 * with a PEC byte after the last register of the block they started in.
+	 * The blocks are the time (00h-06h), the alarms (07h-0Dh), the
+	 * control/status registers (0Eh-13h), the SRAM and the extension
+	 * registers.
+	 */
+	static constexpr bool i2c_block_end(uint8_t addr)
+	{
+		return addr == REG_YEAR || addr == REG_ALARM_2_DAY_OR_DATE ||
+		       addr == REG_CTRL_3 ||
+		       (SRAM_SIZE > 0 && addr == REG_SRAM + SRAM_SIZE - 1) ||
+		       (Config::SUBSECOND && addr == REG_SUBSECOND + 1U) ||
+		       (Config::TIMER && addr == REG_TIMER_COUNT + 1U) ||
+		       (Config::CAPTURE_FIFO_SIZE && addr == REG_CAPTURE_COMMAND) ||
+		       (Config::ALARM_TABLE_SIZE && addr == REG_ALARM_TABLE_COUNT) ||
+		       (Config::MAILBOX && addr == REG_MAILBOX_COMMAND) ||
+		       addr == 0xFF;
+	}
+
 	/**************************************************************************
 	 * Public constants (see datasheets)                                      *
 	 **************************************************************************/
@@ -551,9 +1879,40 @@ public:
 	static constexpr uint8_t BIT_MONTH_CENTURY1 = 0x40;
 	static constexpr uint8_t BIT_MONTH_CENTURY2 = 0x20;
 
+	/**
+	 * Number of seconds between 1900/01/01 and 1970/01/01.
+	 */
+	static constexpr int64_t EPOCH_1900 = 2208988800LL;
+
+	/**
+	 * Number of seconds without PPS edge after which the discipline enters
+	 * holdover, and the gains (as power of two divisors) of the frequency and
+	 * phase corrections.
+	 */
+	static constexpr uint8_t PPS_TIMEOUT = 3;
+	static constexpr uint8_t PPS_FREQ_GAIN = 4;
+	static constexpr uint8_t PPS_PHASE_GAIN = 2;
+
+	/**
+	 * Parameters of the drift estimator. Time sets less than
+	 * DRIFT_MIN_INTERVAL seconds apart are not evaluated; corrections larger
+	 * than 1/2^DRIFT_MAX_ERROR of the interval (about 1.6%) are treated as
+	 * deliberate time changes. Each evaluated time set applies 1/2^DRIFT_GAIN
+	 * of the measured rate error.
+	 */
+	static constexpr uint16_t DRIFT_MIN_INTERVAL = 600;
+	static constexpr uint8_t DRIFT_MAX_ERROR = 6;
+	static constexpr uint8_t DRIFT_GAIN = 1;
+
 	static constexpr uint8_t ACTION_RESET_TIMER = 0x01;
 	static constexpr uint8_t ACTION_CONVERT_TEMPERATURE = 0x02;
 
+	static constexpr uint8_t POWER_OSCILLATOR = 0x01;
+	static constexpr uint8_t POWER_INT_SQW = 0x02;
+	static constexpr uint8_t POWER_SQW = 0x04;
+	static constexpr uint8_t POWER_32KHZ = 0x08;
+	static constexpr uint8_t POWER_BUS = 0x10;
+
 	static constexpr uint8_t REG_SECONDS = 0x00;
 	static constexpr uint8_t REG_MINUTES = 0x01;
 	static constexpr uint8_t REG_HOURS = 0x02;
@@ -576,6 +1935,66 @@ public:
 	static constexpr uint8_t REG_CTRL_3 = 0x13;
 	static constexpr uint8_t REG_SRAM = 0x14;
 
+	/**
+	 * Extension registers. These are only present if the corresponding
+	 * extension is enabled in the Config template parameter.
+	 */
+	static constexpr uint8_t REG_SUBSECOND = 0xD6;
+	static constexpr uint8_t REG_TIMER = 0xD8;
+	static constexpr uint8_t REG_TIMER_RELOAD = 0xD9;
+	static constexpr uint8_t REG_TIMER_COUNT = 0xDB;
+	static constexpr uint8_t REG_CAPTURE = 0xE0;
+	static constexpr uint8_t REG_CAPTURE_COUNT = 0xE6;
+	static constexpr uint8_t REG_CAPTURE_COMMAND = 0xE7;
+	static constexpr uint8_t REG_ALARM_TABLE = 0xE8;
+	static constexpr uint8_t REG_ALARM_TABLE_TAG = 0xEC;
+	static constexpr uint8_t REG_ALARM_TABLE_COMMAND = 0xED;
+	static constexpr uint8_t REG_ALARM_TABLE_STATUS = 0xEE;
+	static constexpr uint8_t REG_ALARM_TABLE_COUNT = 0xEF;
+	static constexpr uint8_t REG_MAILBOX = 0xF0;
+	static constexpr uint8_t REG_MAILBOX_COMMAND = 0xF8;
+
+	static constexpr uint8_t CMD_STATUS_DONE = 0x00;
+	static constexpr uint8_t CMD_STATUS_ERROR = 0xFF;
+
+	static constexpr uint8_t MAILBOX_CMD_SET_EPOCH = 0x01;
+	static constexpr uint8_t MAILBOX_CMD_SET_TIME = 0x02;
+	static constexpr uint8_t CAPTURE_CMD_POP = 0x01;
+	static constexpr uint8_t CAPTURE_CMD_CLEAR = 0x02;
+
+	static constexpr uint8_t BIT_CAPTURE_OVF = 0x80;
+
+	static constexpr uint8_t ALARM_TABLE_CMD_INSERT = 0x01;
+	static constexpr uint8_t ALARM_TABLE_CMD_POP = 0x02;
+	static constexpr uint8_t ALARM_TABLE_CMD_PEEK = 0x03;
+	static constexpr uint8_t ALARM_TABLE_CMD_CLEAR = 0x04;
+
+	static constexpr uint8_t BIT_ALARM_TABLE_ATF = 0x80;
+	static constexpr uint8_t BIT_ALARM_TABLE_ATIE = 0x40;
+
+	static constexpr uint8_t BIT_TIMER_TE = 0x80;
+	static constexpr uint8_t BIT_TIMER_TIE = 0x40;
+	static constexpr uint8_t BIT_TIMER_TF = 0x20;
+	static constexpr uint8_t BIT_TIMER_TP = 0x10;
+
+	/**
+	 * Address of the first extension register. 0x100 if no extension is
+	 * enabled.
+	 */
+	static constexpr unsigned int REG_EXT_BEGIN =
+	    Config::SUBSECOND
+	        ? REG_SUBSECOND
+	        : (Config::TIMER
+	               ? REG_TIMER
+	               : (Config::CAPTURE_FIFO_SIZE
+	                      ? REG_CAPTURE
+	                      : (Config::ALARM_TABLE_SIZE
+	                             ? REG_ALARM_TABLE
+	                             : (Config::MAILBOX ? REG_MAILBOX : 0x100))));
+
+	static_assert(REG_SRAM + SRAM_SIZE <= REG_EXT_BEGIN,
+	              "SRAM overlaps with the extension registers");
+
 	/**************************************************************************
 	 * Constructor                                                            *
 	 **************************************************************************/
@@ -651,6 +2070,15 @@ public:
 	 */
 	uint8_t year() const { return bcd_dec(m_regs.regs.year & MASK_YEAR); }
 
+	/**
+	 * Returns the number of days in the current month.
+	 */
+	uint8_t month_days() const
+	{
+		return m_wrote_date ? number_of_days(month(), century(), year())
+		                    : bcd_dec(m_calendar.month_days);
+	}
+
 	/**
 	 * Returns the first two digits of the current year, i.e. the year divided
 	 * by 100. Assuming that a century value of "0" stored in the RTC registers
@@ -673,6 +2101,114 @@ public:
 		return century;
 	}
 
+	/**
+	 * Returns the current time as the number of seconds since 1970/01/01
+	 * 00:00:00, not counting leap seconds. Dates before 1970 result in a
+	 * negative value. Does not use division or 64-bit multiplication.
+	 */
+	int64_t epoch() const
+	{
+		// Convert to seconds and move the origin to 1970/01/01. The days fit
+		// into 32 bits when multiplied by 675, and 86400 = 675 * 2^7.
+		const uint32_t secs = uint32_t(hours()) * 3600UL +
+		                      uint16_t(minutes()) * 60U + seconds();
+		return (int64_t(days_since_1900() * 675UL) << 7U) + secs - EPOCH_1900;
+	}
+
+	/**
+	 * Sets the current time to the given number of seconds since 1970/01/01
+	 * 00:00:00, not counting leap seconds. The day of the week is set
+	 * according to the convention that Monday is "1", the 12/24 hour mode is
+	 * preserved. Does not use division or multiplication.
+	 *
+	 * @param t is the time that should be set. Must correspond to a date
+	 * between 1900/01/01 and 2699/12/31.
+	 * @return true if the time was set, false if the given value is out of
+	 * range.
+	 */
+	bool set_epoch(int64_t t)
+	{
+		if (t < -EPOCH_1900) {
+			return false;
+		}
+
+		// Skip whole years starting at Monday, 1900/01/01
+		uint64_t s = uint64_t(t + EPOCH_1900);
+		uint8_t c = 19U, y = 0U, dy = 1U;
+		while (true) {
+			const bool leap = is_leap_year(c, y);
+			const uint32_t n = leap ? 366UL * 86400UL : 365UL * 86400UL;
+			if (s < n) {
+				break;
+			}
+			s -= n;
+			dy += leap ? 2U : 1U;
+			if (dy > 7U) {
+				dy -= 7U;
+			}
+			if (++y == 100U) {
+				y = 0U;
+				if (++c > 26U) {
+					return false;
+				}
+			}
+		}
+
+		// Skip whole months and days within the year
+		uint32_t r = uint32_t(s);
+		uint8_t mo = 1U, dt = 1U;
+		while (true) {
+			const uint8_t n_days = number_of_days(mo, c, y);
+			const uint32_t n = n_days * 86400UL;
+			if (r < n) {
+				break;
+			}
+			r -= n;
+			dy += n_days - 28U;  // 28 days are exactly four weeks
+			if (dy > 7U) {
+				dy -= 7U;
+			}
+			mo++;
+		}
+		for (; r >= 86400UL; r -= 86400UL) {
+			dt++;
+			if (++dy > 7U) {
+				dy = 1U;
+			}
+		}
+
+		// Split the remaining seconds into hours, minutes and seconds
+		uint8_t hh = 0U, mm = 0U;
+		for (; r >= 3600UL; r -= 3600UL) {
+			hh++;
+		}
+		for (; r >= 60UL; r -= 60UL) {
+			mm++;
+		}
+
+		// Write the registers and reset the countdown chain
+		Registers &regs = m_regs.regs;
+		regs.seconds = bcd_enc(r);
+		regs.minutes = bcd_enc(mm);
+		regs.hours = encode_hours(hh, regs.hours & BIT_HOUR_12_HOURS);
+		regs.day = dy;
+		regs.date = bcd_enc(dt);
+		regs.month = bcd_enc(mo) | (((c - 19U) & 1U) ? BIT_MONTH_CENTURY0 : 0U) |
+		             (((c - 19U) & 2U) ? BIT_MONTH_CENTURY1 : 0U) |
+		             (((c - 19U) & 4U) ? BIT_MONTH_CENTURY2 : 0U);
+		regs.year = bcd_enc(y);
+		atomic_discard_ticks();
+		m_wrote_date = false;
+		m_alarm_match = 0U;
+		m_calendar.century = c;
+		m_calendar.leap = is_leap_year(c, y);
+		m_calendar.month_days = bcd_enc(days_in_month(mo, m_calendar.leap));
+		if (HAS_EPOCH_CACHE) {
+			ext<EpochCache>().valid = false;
+		}
+		return true;
+	}
+
 	/**************************************************************************
 	 * Control API                                                            *
 	 **************************************************************************/
@@ -684,8 +2220,39 @@ public:
 	void reset()
 	{
 		// Reset the internal state
-		atomic_consume_ticks();
+		atomic_discard_ticks();
 		m_wrote_date = false;
+		m_alarm_match = 0U;
+		if (Config::ALARM_TABLE_SIZE) {
+			AlarmTable &a = ext<AlarmTable>();
+			a.len = 0U;
+			a.command = CMD_STATUS_DONE;
+			a.status = 0U;
+			for (uint8_t i = 0U; i < sizeof(a.regs); i++) {
+				a.regs[i] = 0U;
+			}
+		}
+		if (Config::CAPTURE_FIFO_SIZE) {
+			Capture &c = ext<Capture>();
+			c.head = c.tail = 0U;
+			c.overflow = false;
+			c.command = CMD_STATUS_DONE;
+			for (uint8_t i = 0U; i < sizeof(c.regs); i++) {
+				c.regs[i] = 0U;
+			}
+		}
+		if (Config::MAILBOX) {
+			Mailbox &m = ext<Mailbox>();
+			for (uint8_t i = 0U; i < sizeof(m.regs); i++) {
+				m.regs[i] = 0U;
+			}
+		}
+		if (Config::TIMER) {
+			Timer &t = ext<Timer>();
+			t.ctrl = 0U;
+			t.reload = 0U;
+			t.count = 0U;
+		}
 
 		// Reset the date to 2019/01/01 at 00:00:00.
 		m_regs.regs.seconds = bcd_enc(0);
@@ -695,6 +2262,7 @@ public:
 		m_regs.regs.date = bcd_enc(1);
 		m_regs.regs.month = bcd_enc(1) | BIT_MONTH_CENTURY;
 		m_regs.regs.year = bcd_enc(19);
+		calendar_sync();
 
 		// Reset the alarms
 		m_regs.regs.alarm_1_seconds = bcd_enc(0);
@@ -713,6 +2281,37 @@ public:
 		m_regs.regs.temp_msb = 0xFF;
 		m_regs.regs.temp_lsb = 0xC0;
 		m_regs.regs.ctrl_3 = 0;
+
+		// Reset the tick rate to the nominal value
+		if (HAS_RATE) {
+			Rate &r = ext<Rate>();
+			r.period = uint32_t(Config::TICK_PERIOD) << 16U;
+			r.frac = 0U;
+			r.current = Config::TICK_PERIOD;
+			r.phase_adj = 0;
+			r.pps_pending = false;
+			r.pps_age = 255U;
+			r.pps_valid = false;
+		}
+		if (Config::DRIFT_ESTIMATOR) {
+			Drift &d = ext<Drift>();
+			d.elapsed = 0U;
+			d.pending = false;
+			d.valid = false;
+		}
+		if (Config::SUBSECOND) {
+			Subsecond &s = ext<Subsecond>();
+			s.offset = 0U;
+			s.preload = 0U;
+			s.armed = false;
+			s.hold = false;
+		}
+
+		// Compute the cached UNIX time
+		if (HAS_EPOCH_CACHE) {
+			ext<EpochCache>().valid = false;
+			epoch_cache_sync();
+		}
 	}
 
 	/**
@@ -724,6 +2323,81 @@ public:
 		m_regs.regs.ctrl_2 = m_regs.regs.ctrl_2 | BIT_CTRL_2_OSF;
 	}
 
+	/**
+	 * Returns true if the active-low interrupt output (INT/SQW) should be
+	 * asserted. This is the case if the interrupt mode is selected (INTCN)
+	 * and an alarm flag with enabled interrupt is set, if the head of the
+	 * alarm table expired and the ATIE bit is set, or if the countdown timer
+	 * expired and the TIE bit is set.
+	 */
+	bool interrupt() const
+	{
+		const Registers &t = m_regs.regs;
+		bool res = (t.ctrl_1 & BIT_CTRL_1_INTCN) &&
+		           (((t.ctrl_1 & BIT_CTRL_1_A1IE) &&
+		             (t.ctrl_2 & BIT_CTRL_2_A1F)) ||
+		            ((t.ctrl_1 & BIT_CTRL_1_A2I1) &&
+		             (t.ctrl_2 & BIT_CTRL_2_A2F)));
+		if (Config::ALARM_TABLE_SIZE) {
+			res = res || ((ext<AlarmTable>().status & BIT_ALARM_TABLE_ATIE) &&
+			              alarm_table_expired());
+		}
+		if (Config::TIMER) {
+			res = res || ((ext<Timer>().ctrl & BIT_TIMER_TIE) &&
+			              (ext<Timer>().ctrl & BIT_TIMER_TF));
+		}
+		return res;
+	}
+
+	/**
+	 * Returns the parts of the device that should be powered in the current
+	 * supply state as a combination of the POWER_* bits. While supplied by
+	 * the host, everything except the square wave in interrupt mode (INTCN)
+	 * and the 32 kHz output without EN32KHZ is running. On battery, as
+	 * described in the DS3232 datasheet,
+	 *
+	 * - the oscillator (POWER_OSCILLATOR) stops if EOSC is set. The ticks
+	 *   received in this state are discarded by update() and OSF is set.
+	 * - the INT/SQW pin (POWER_INT_SQW) is high impedance unless BBSQW is set.
+	 *   This applies to the alarm interrupts as well as to the square wave
+	 *   (POWER_SQW).
+	 * - the 32 kHz output (POWER_32KHZ) is disabled unless BB32KHZ is set.
+	 * - the serial interface (POWER_BUS) is inaccessible.
+	 *
+	 * The host should gate the tick source, the outputs and the bus
+	 * peripheral accordingly and use the deepest sleep mode that keeps the
+	 * remaining parts running.
+	 */
+	uint8_t power_state() const
+	{
+		const Registers &t = m_regs.regs;
+		if (!Config::Power::on_battery()) {
+			uint8_t res = POWER_OSCILLATOR | POWER_INT_SQW | POWER_BUS;
+			if (!(t.ctrl_1 & BIT_CTRL_1_INTCN)) {
+				res |= POWER_SQW;
+			}
+			if (t.ctrl_2 & BIT_CTRL_2_EN32KHZ) {
+				res |= POWER_32KHZ;
+			}
+			return res;
+		}
+		if (t.ctrl_1 & BIT_CTRL_1_EOSC) {
+			return 0U;
+		}
+		uint8_t res = POWER_OSCILLATOR;
+		if (t.ctrl_1 & BIT_CTRL_1_BBSQW) {
+			res |= POWER_INT_SQW;
+			if (!(t.ctrl_1 & BIT_CTRL_1_INTCN)) {
+				res |= POWER_SQW;
+			}
+		}
+		if ((t.ctrl_2 & BIT_CTRL_2_EN32KHZ) &&
+		    (t.ctrl_2 & BIT_CTRL_2_BB32KHZ)) {
+			res |= POWER_32KHZ;
+		}
+		return res;
+	}
+
 	/**
 	 * Updates the time by one second. This function is designed to be called
 	 * from an ISR. Assuming that writes to uint8_t are atomic (which is true
@@ -732,7 +2406,141 @@ public:
 	 * update() function. You must ensure that update() is called at least
 	 * every 255 seconds.
 	 */
-	void tick() { m_ticks++; }
+	void tick()
+	{
+		const ProbeScope<Soft323xProbePath::TICK> probe;
+		m_ticks.increment();
+	}
+
+	/**
+	 * Computes the number of second timer counts until the next tick. This
+	 * function is designed to be called from the timer ISR right after tick().
+	 * The integer part of the estimated period is returned, the fractional
+	 * part is carried over to the next second. Returns TICK_PERIOD if the rate
+	 * control is disabled.
+	 */
+	uint16_t next_tick_period()
+	{
+		if (!HAS_RATE) {
+			return Config::TICK_PERIOD;
+		}
+		Rate &r = ext<Rate>();
+		const uint32_t p = r.period + r.frac;
+		r.frac = uint16_t(p);
+		r.current = uint16_t(p >> 16U) + r.phase_adj;
+		r.phase_adj = 0;
+		return r.current;
+	}
+
+	/**
+	 * Registers an edge of the pulse-per-second signal. This function is
+	 * designed to be called from an ISR and only records the phase; the
+	 * actual discipline takes place in update(). Does nothing if the PPS
+	 * discipline is disabled.
+	 *
+	 * @param phase is the value of the second timer at the time of the edge.
+	 */
+	void pps(uint16_t phase)
+	{
+		if (Config::PPS) {
+			ext<Rate>().pps_phase = phase;
+			ext<Rate>().pps_pending = true;
+		}
+	}
+
+	/**
+	 * Returns true if the PPS discipline is locked to the PPS signal, false
+	 * if there was no PPS edge for more than PPS_TIMEOUT seconds (holdover).
+	 */
+	bool pps_locked() const { return Config::PPS && ext<Rate>().pps_valid; }
+
+	/**
+	 * Reports the value of the second timer right before it was reset because
+	 * the host set the time, i.e. the fraction of the second that had elapsed.
+	 * This makes the drift estimate more precise; without it, half a second is
+	 * assumed. Should be called in response to ACTION_RESET_TIMER. Does
+	 * nothing if the drift estimator is disabled.
+	 *
+	 * @param count is the value of the second timer before the reset.
+	 */
+	void time_set_phase(uint16_t count)
+	{
+		if (Config::DRIFT_ESTIMATOR && ext<Drift>().pending) {
+			ext<Drift>().phase = count;
+		}
+	}
+
+	/**
+	 * Must be called at the end of each write message, i.e. when the master
+	 * sends a STOP or a repeated START condition after writing to the device.
+	 * A sub-second offset armed at D6h-D7h is discarded at the end of the
+	 * next write message if that message did not set the time. Does nothing
+	 * if the sub-second extension is disabled.
+	 */
+	void i2c_stop()
+	{
+		if (Config::SUBSECOND) {
+			Subsecond &s = ext<Subsecond>();
+			s.armed = s.armed && s.hold;
+			s.hold = false;
+		}
+	}
+
+	/**
+	 * Returns the value the second timer should be loaded with instead of
+	 * zero in response to ACTION_RESET_TIMER. If the host armed a sub-second
+	 * offset at D6h-D7h before setting the time, this is the corresponding
+	 * number of timer counts, such that the next tick occurs when the host's
+	 * second ends. Returns zero if the extension is disabled.
+	 */
+	uint16_t timer_preload() const
+	{
+		return Config::SUBSECOND ? ext<Subsecond>().preload : 0U;
+	}
+
+	/**
+	 * Returns the estimated number of second timer counts per second as 16.16
+	 * fixed point number, or TICK_PERIOD if the rate control is disabled.
+	 */
+	uint32_t tick_period() const
+	{
+		return HAS_RATE ? ext<Rate>().period
+		                : (uint32_t(Config::TICK_PERIOD) << 16U);
+	}
+
+	/**
+	 * Captures the current time into the timestamp FIFO. This function is
+	 * designed to be called from an input capture ISR and only copies the
+	 * cached UNIX time and the number of uncommitted ticks. If the FIFO is
+	 * full, the overflow flag is set and the event is dropped. Events captured
+	 * after the host wrote the time are marked as stale and receive the new
+	 * time in the next update(); popping them fails until then. On platforms
+	 * other than AVR, this must not be called concurrently to update(). Does
+	 * nothing if the capture FIFO is disabled.
+	 *
+	 * @param count is the value of the second timer at the time of the event,
+	 * i.e. the fraction of the current second in timer counts.
+	 */
+	void capture(uint16_t count)
+	{
+		if (!Config::CAPTURE_FIFO_SIZE) {
+			return;
+		}
+		Capture &c = ext<Capture>();
+		const uint8_t head = c.head;
+		if (uint8_t(head - c.tail) >= Config::CAPTURE_FIFO_SIZE) {
+			c.overflow = true;
+			return;
+		}
+		typename Capture::Entry &e =
+		    c.fifo[head & (Config::CAPTURE_FIFO_SIZE - 1U)];
+		const EpochCache &ec = ext<EpochCache>();
+		e.time = ec.now;
+		e.ticks = m_ticks.load();
+		e.count = count;
+		e.stale = !ec.valid;
+		c.head = head + 1U;
+	}
 
 	/**
 	 * Commits all ticks collected so far. This function must be called
@@ -750,6 +2558,8 @@ public:
 	 */
 	bool update()
 	{
+		const ProbeScope<Soft323xProbePath::UPDATE> probe;
+
 		// If the date was modified, make sure that the date is valid. Otherwise
 		// strange things will happen while trying to update the time.
 		if (m_wrote_date) {
@@ -757,15 +2567,115 @@ public:
 			m_wrote_date = false;
 		}
 
+		// Make sure the cached UNIX time is up-to-date
+		if (HAS_EPOCH_CACHE) {
+			epoch_cache_sync();
+		}
+
+		// Evaluate the time set by the host before applying any new ticks
+		if (Config::DRIFT_ESTIMATOR) {
+			drift_evaluate();
+		}
+
+		// Discard the ticks received while the oscillator is stopped on
+		// battery; the time is no longer valid
+		if (!(power_state() & POWER_OSCILLATOR)) {
+			atomic_discard_ticks();
+			set_oscillator_stop_flag();
+			return false;
+		}
+
 		// Consume the ticks and increment time in seconds steps
 		uint8_t ticks = atomic_consume_ticks();
 		for (uint8_t i = 0; i < ticks; i++) {
-			increment_time();
-			check_alarms();
+			check_alarms(increment_time());
+		}
+		if (Config::PPS) {
+			pps_process(ticks);
+		}
+		if (Config::TIMER) {
+			timer_process(ticks);
+		}
+		if (Config::DRIFT_ESTIMATOR) {
+			drift_count(ticks);
 		}
 		return ticks > 0;
 	}
 
+	/**
+	 * Advances the clock by the given number of seconds, independently of the
+	 * ticks queued by tick(). The result, including the alarm flags, is the
+	 * same as calling tick() and update() n times. However, seconds in which
+	 * no alarm can match are skipped in bulk, so the cost is about constant
+	 * per minute. Meant for hosted simulations running faster than real time;
+	 * must not be called while the I2C bus is active.
+	 *
+	 * @param n is the number of seconds the clock should be advanced by.
+	 */
+	void advance(uint32_t n)
+	{
+		if (m_wrote_date) {
+			canonicalise_date();
+			m_wrote_date = false;
+		}
+		if (HAS_EPOCH_CACHE) {
+			epoch_cache_sync();
+#if __AVR__
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#endif
+			{
+				ext<EpochCache>().now += n;
+			}
+		}
+		if (Config::DRIFT_ESTIMATOR) {
+			drift_evaluate();
+			drift_count(n);
+		}
+		if (Config::TIMER) {
+			timer_process(n);
+		}
+
+		Registers &t = m_regs.regs;
+		bool a1_idle = false;  // Alarm 1 cannot match in this minute
+		while (n > 0U) {
+			// Number of seconds until the minute overflows
+			const uint8_t ss = bcd_dec(t.seconds & MASK_SECONDS);
+			const uint32_t k = (ss < 59U) ? (59U - ss) : 0U;
+			if (k == 0U) {
+				check_alarms(increment_time());
+				a1_idle = false;
+				n--;
+				continue;
+			}
+
+			// Only Alarm 1 can match within the minute. Minutes, hours and date
+			// are constant, so if it does not match at one second and ignores
+			// the seconds, it does not match in the rest of the minute.
+			uint8_t target = ss + ((n < k) ? n : k);
+			bool check = false;
+			if (!a1_idle && !(t.ctrl_2 & BIT_CTRL_2_A1F)) {
+				if (t.alarm_1_seconds & BIT_ALARM_MODE) {
+					target = ss + 1U;
+					check = true;
+					a1_idle = true;
+				}
+				else {
+					const uint8_t a1_ss =
+					    bcd_dec(t.alarm_1_seconds & MASK_SECONDS);
+					if (a1_ss > ss && a1_ss <= target) {
+						target = a1_ss;
+						check = true;
+					}
+				}
+			}
+			t.seconds = (t.seconds & ~MASK_SECONDS) | bcd_enc(target);
+			n -= target - ss;
+			if (check) {
+				check_alarms(FIELD_SECONDS);
+			}
+		}
+	}
+
 	/**************************************************************************
 	 * I2C Interface                                                          *
 	 **************************************************************************/
@@ -778,8 +2688,13 @@ public:
 	 */
 	uint8_t i2c_read(uint8_t addr) const
 	{
+		const ProbeScope<Soft323xProbePath::I2C_READ> probe;
+
 		// Make sure the read is not out of bounds
 		if (addr >= sizeof(Registers)) {
+			if (addr >= REG_EXT_BEGIN) {
+				return ext_read(addr);
+			}
 			return 0U;
 		}
 
@@ -792,15 +2707,23 @@ public:
 	 */
 	uint8_t i2c_write(uint8_t addr, uint8_t value)
 	{
+		const ProbeScope<Soft323xProbePath::I2C_WRITE> probe;
+
 		uint8_t res = 0;
 		switch (addr) {
 			case REG_SECONDS:  // Reg 00h: Seconds
+				if (Config::DRIFT_ESTIMATOR) {
+					drift_begin();
+				}
+				if (Config::SUBSECOND) {
+					subsecond_begin();
+				}
 				res |= ACTION_RESET_TIMER;
 				// fallthrough
 			case REG_ALARM_1_SECONDS:  // Reg 07h: Seconds
 				m_regs.mem[addr] =
 				    bcd_canon(value & MASK_SECONDS, bcd_enc(0), bcd_enc(59));
-				atomic_consume_ticks();
+				atomic_discard_ticks();
 				break;                 // Reset countdown chain
 			case REG_MINUTES:          // Reg 01h: Minutes
 			case REG_ALARM_1_MINUTES:  // Reg 08h: Alarm 1 Minutes
@@ -889,6 +2812,9 @@ public:
 				if (addr < sizeof(m_regs)) {
 					m_regs.mem[addr] = value;
 				}
+				else if (addr >= REG_EXT_BEGIN) {
+					res |= ext_write(addr, value);
+				}
 				break;
 		}
 
@@ -897,17 +2823,27 @@ public:
 			m_regs.mem[addr] = m_regs.mem[addr] | BIT_ALARM_MODE;
 		}
 
+		// The cached UNIX time must be recomputed if the time was written
+		if (HAS_EPOCH_CACHE && addr <= REG_YEAR) {
+			ext<EpochCache>().valid = false;
+		}
+
+		// Compare all alarm fields again if the time or an alarm was written
+		if (addr <= REG_ALARM_2_DAY_OR_DATE) {
+			m_alarm_match = 0U;
+		}
+
 		return res;
 	}
 
 	/**
 	 * Returns the next I2C address. Updates the clock when the next address is
-	 * zero.
+	 * zero. If extensions are enabled, the address only wraps at FFh.
 	 */
 	uint8_t i2c_next_addr(uint8_t addr)
 	{
 		addr++;
-		if (addr >= sizeof(Registers)) {
+		if (REG_EXT_BEGIN > 0xFF && addr >= sizeof(Registers)) {
 			addr = 0;
 		}
 		if (addr == 0) {
@@ -0,0 +1,360 @@
+/**
+ *  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Host-side client for reading the time from a Soft323x (or DS323x) device.
+ * Instead of reading the time registers for every query, the client reads
+ * them once per resync interval and extrapolates the time from
+ * CLOCK_MONOTONIC in between. The bus is accessed through a backend class;
+ * Soft323xI2cDev talks to a device via /dev/i2c-N, Soft323xEmulatedBus to a
+ * Soft323x instance in the same process.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef SOFT323X_CLIENT_HPP
+#define SOFT323X_CLIENT_HPP
+
+#include "soft323x.hpp"
+
+#include <fcntl.h>
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Returns the CLOCK_MONOTONIC time in nanoseconds.
+ */
+inline uint64_t soft323x_monotonic_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return uint64_t(ts.tv_sec) * 1000000000ULL + uint64_t(ts.tv_nsec);
+}
+
+/**
+ * Backend accessing a device on a Linux I2C bus. Register reads are issued
+ * as a single combined I2C_RDWR transaction (address write, repeated start,
+ * burst read), so the device cannot update the time in between.
+ */
+class Soft323xI2cDev {
+private:
+	int m_fd;
+	uint16_t m_addr;
+
+public:
+	/**
+	 * Opens the given I2C bus device, e.g. "/dev/i2c-1".
+	 */
+	explicit Soft323xI2cDev(const char *path, uint16_t addr = 0x68)
+	    : m_fd(::open(path, O_RDWR)), m_addr(addr)
+	{
+	}
+
+	~Soft323xI2cDev()
+	{
+		if (m_fd >= 0) {
+			::close(m_fd);
+		}
+	}
+
+	Soft323xI2cDev(const Soft323xI2cDev &) = delete;
+	Soft323xI2cDev &operator=(const Soft323xI2cDev &) = delete;
+
+	bool ok() const { return m_fd >= 0; }
+
+	bool read(uint8_t reg, uint8_t *buf, uint8_t len)
+	{
+		struct i2c_msg msgs[2] = {
+		    {m_addr, 0, 1, &reg},
+		    {m_addr, I2C_M_RD, len, buf},
+		};
+		struct i2c_rdwr_ioctl_data data = {msgs, 2};
+		return ioctl(m_fd, I2C_RDWR, &data) == 2;
+	}
+
+	bool write(uint8_t reg, const uint8_t *buf, uint8_t len)
+	{
+		uint8_t tmp[256];
+		tmp[0] = reg;
+		for (uint8_t i = 0; i < len && i < 255U; i++) {
+			tmp[i + 1] = buf[i];
+		}
+		struct i2c_msg msg = {m_addr, 0, uint16_t(len + 1U), tmp};
+		struct i2c_rdwr_ioctl_data data = {&msg, 1};
+		return ioctl(m_fd, I2C_RDWR, &data) == 1;
+	}
+};
+
+/**
+ * Backend emulating a device in userspace. The ticks elapsed on the given
+ * clock are applied whenever the device is accessed; each call corresponds to
+ * one bus transaction.
+ */
+template <typename RTC = Soft323x<>>
+class Soft323xEmulatedBus {
+private:
+	static constexpr uint64_t NS_PER_TICK = 1000000000ULL;
+
+	uint64_t (*m_clock)();
+	RTC m_rtc;
+	uint64_t m_origin;  // Clock time of the last timer reset
+	uint64_t m_ticks;   // Ticks applied since m_origin
+	uint64_t m_transactions;
+
+	void sync()
+	{
+		const uint64_t target = (m_clock() - m_origin) / NS_PER_TICK;
+		uint64_t n = target - m_ticks;
+		while (n > 0) {
+			const uint32_t k = (n > 0xFFFFFFFFULL) ? 0xFFFFFFFFUL : uint32_t(n);
+			m_rtc.advance(k);
+			n -= k;
+		}
+		m_ticks = target;
+	}
+
+public:
+	explicit Soft323xEmulatedBus(uint64_t (*clock)() = soft323x_monotonic_ns)
+	    : m_clock(clock), m_origin(clock()), m_ticks(0), m_transactions(0)
+	{
+	}
+
+	RTC &rtc() { return m_rtc; }
+
+	/**
+	 * Number of bus transactions performed so far.
+	 */
+	uint64_t transactions() const { return m_transactions; }
+
+	bool read(uint8_t reg, uint8_t *buf, uint8_t len)
+	{
+		m_transactions++;
+		sync();
+		for (uint8_t i = 0; i < len; i++) {
+			buf[i] = m_rtc.i2c_read(reg);
+			reg = m_rtc.i2c_next_addr(reg);
+		}
+		return true;
+	}
+
+	bool write(uint8_t reg, const uint8_t *buf, uint8_t len)
+	{
+		m_transactions++;
+		sync();
+		for (uint8_t i = 0; i < len; i++) {
+			if (m_rtc.i2c_write(reg, buf[i]) & RTC::ACTION_RESET_TIMER) {
+				m_origin = m_clock();
+				m_ticks = 0;
+			}
+			reg = m_rtc.i2c_next_addr(reg);
+		}
+		m_rtc.i2c_stop();
+		m_rtc.update();
+		return true;
+	}
+};
+
+/**
+ * Serves time queries by extrapolating from the last read of the time
+ * registers.
+ *
+ * The device time is modelled as floor(t + offset), where t is the monotonic
+ * time. Each read of the time registers that started at t0 and ended at t1
+ * and returned the time s constrains the offset to s - t1 <= offset <
+ * s + 1 - t0. The client intersects these intervals over successive reads and
+ * extrapolates using the lower bound, so the returned time never runs ahead
+ * of the device and converges to it as more reads are made. Reads are timed
+ * such that the device is expected to tick right at the centre of the
+ * interval, which halves it with each read. The interval is widened between
+ * reads to account for the rate difference of the clocks.
+ *
+ * @tparam Bus is the backend, providing read() and write() as
+ * Soft323xI2cDev.
+ */
+template <typename Bus>
+class Soft323xClient {
+private:
+	using RTC = Soft323x<>;
+
+	static constexpr int64_t NS_PER_SEC = 1000000000LL;
+
+	Bus &m_bus;
+	uint64_t (*m_clock)();
+	uint64_t m_resync_ns;
+	uint32_t m_drift_ppm;
+
+	bool m_valid;
+	uint64_t m_last_sync;  // Monotonic time of the last read
+	uint64_t m_next_sync;  // Monotonic time at which to read next
+	int64_t m_lo, m_hi;    // Bounds of the offset in nanoseconds
+	uint64_t m_reads;
+
+	/**
+	 * Converts the time registers 00h-06h to a UNIX time stamp.
+	 */
+	static int64_t decode(const uint8_t *regs)
+	{
+		RTC rtc;
+		for (uint8_t i = RTC::REG_SECONDS; i <= RTC::REG_YEAR; i++) {
+			rtc.i2c_write(i, regs[i]);
+		}
+		rtc.update();
+		return rtc.epoch();
+	}
+
+	/**
+	 * Computes the time of the next read: the first time after the resync
+	 * interval at which the device ticks if the offset is at the centre of
+	 * the current interval.
+	 */
+	void schedule()
+	{
+		const uint64_t base = m_last_sync + m_resync_ns;
+		const int64_t mid = m_lo + (m_hi - m_lo) / 2;
+		int64_t frac = (int64_t(base) + mid) % NS_PER_SEC;
+		frac = (frac < 0) ? (frac + NS_PER_SEC) : frac;
+		m_next_sync = base + uint64_t((NS_PER_SEC - frac) % NS_PER_SEC);
+	}
+
+public:
+	/**
+	 * @param bus is the backend used to access the device.
+	 * @param resync_ns is the interval in which the time registers are read.
+	 * @param drift_ppm is the maximum rate difference between the device and
+	 * the monotonic clock.
+	 * @param clock returns the monotonic time in nanoseconds.
+	 */
+	explicit Soft323xClient(Bus &bus, uint64_t resync_ns = 60000000000ULL,
+	                        uint32_t drift_ppm = 100,
+	                        uint64_t (*clock)() = soft323x_monotonic_ns)
+	    : m_bus(bus),
+	      m_clock(clock),
+	      m_resync_ns(resync_ns),
+	      m_drift_ppm(drift_ppm),
+	      m_valid(false),
+	      m_last_sync(0),
+	      m_next_sync(0),
+	      m_lo(0),
+	      m_hi(0),
+	      m_reads(0)
+	{
+	}
+
+	/**
+	 * Reads the time registers in a single burst and refines the offset.
+	 *
+	 * @return false if the bus access failed.
+	 */
+	bool sync()
+	{
+		uint8_t regs[7];
+		const uint64_t t0 = m_clock();
+		if (!m_bus.read(RTC::REG_SECONDS, regs, 7)) {
+			return false;
+		}
+		const uint64_t t1 = m_clock();
+		m_reads++;
+
+		const int64_t s = decode(regs) * NS_PER_SEC;
+		const int64_t lo = s - int64_t(t1);
+		const int64_t hi = s + NS_PER_SEC - int64_t(t0);
+		if (m_valid) {
+			// Widen the interval by the possible drift since the last read
+			const int64_t drift =
+			    int64_t((t1 - m_last_sync) / 1000000ULL * m_drift_ppm);
+			m_lo -= drift;
+			m_hi += drift;
+		}
+		if (!m_valid || lo >= m_hi || hi <= m_lo) {
+			// First read or the device time was changed
+			m_lo = lo;
+			m_hi = hi;
+		}
+		else {
+			m_lo = (lo > m_lo) ? lo : m_lo;
+			m_hi = (hi < m_hi) ? hi : m_hi;
+		}
+		m_valid = true;
+		m_last_sync = t1;
+		schedule();
+		return true;
+	}
+
+	/**
+	 * Returns the current time of the device as UNIX time stamp. Reads the
+	 * device only if the last read is older than the resync interval.
+	 *
+	 * @param epoch receives the time.
+	 * @return false if the device could not be read.
+	 */
+	bool time(int64_t &epoch)
+	{
+		const uint64_t now = m_clock();
+		if (!m_valid || now >= m_next_sync) {
+			if (!sync()) {
+				return false;
+			}
+		}
+		const int64_t t = int64_t(m_clock()) + m_lo;
+		epoch = (t >= 0) ? (t / NS_PER_SEC) : -((-t - 1) / NS_PER_SEC) - 1;
+		return true;
+	}
+
+	/**
+	 * Writes the given UNIX time stamp to the device.
+	 */
+	bool set_epoch(int64_t epoch)
+	{
+		RTC rtc;
+		if (!rtc.set_epoch(epoch)) {
+			return false;
+		}
+		uint8_t regs[7];
+		for (uint8_t i = RTC::REG_SECONDS; i <= RTC::REG_YEAR; i++) {
+			regs[i] = rtc.i2c_read(i);
+		}
+		const uint64_t t0 = m_clock();
+		if (!m_bus.write(RTC::REG_SECONDS, regs, 7)) {
+			return false;
+		}
+
+		// Writing the seconds restarts the second of the device
+		m_lo = epoch * NS_PER_SEC - int64_t(m_clock());
+		m_hi = epoch * NS_PER_SEC - int64_t(t0);
+		m_hi = (m_hi > m_lo) ? m_hi : (m_lo + 1);
+		m_valid = true;
+		m_last_sync = m_clock();
+		schedule();
+		return true;
+	}
+
+	/**
+	 * Upper bound of the error of the extrapolated time in nanoseconds.
+	 */
+	int64_t uncertainty() const { return m_valid ? (m_hi - m_lo) : -1; }
+
+	/**
+	 * Number of reads of the time registers performed so far.
+	 */
+	uint64_t reads() const { return m_reads; }
+};
+
+#endif /* SOFT323X_CLIENT_HPP */
@@ -0,0 +1,501 @@
+/**
+ *  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Optional C++20 runtime for simulating many Soft323x devices on a host. Each
+ * device is driven by a coroutine that awaits virtual time, timer ticks and
+ * I2C transactions. The coroutines are scheduled over a virtual clock by
+ * either a single-threaded or a work-stealing executor.
+ *
+ * Devices tick lazily: the ticks elapsed since the last access are applied
+ * whenever the owning coroutine touches the device, so idle devices cost
+ * nothing. A device must only be accessed by a single coroutine at a time.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef SOFT323X_CORO_HPP
+#define SOFT323X_CORO_HPP
+
+#include "soft323x.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/******************************************************************************
+ * Executors                                                                  *
+ ******************************************************************************/
+
+/**
+ * Interface implemented by the executors. Time is measured in nanoseconds of
+ * virtual time.
+ */
+class Soft323xExecutor {
+private:
+	static inline thread_local Soft323xExecutor *s_current = nullptr;
+
+protected:
+	struct Item {
+		uint64_t t;
+		uint64_t seq;
+		std::coroutine_handle<> h;
+
+		bool operator>(const Item &o) const
+		{
+			return (t != o.t) ? (t > o.t) : (seq > o.seq);
+		}
+	};
+
+	using Heap =
+	    std::priority_queue<Item, std::vector<Item>, std::greater<Item>>;
+
+	/**
+	 * Marks this executor as the one running on the current thread.
+	 */
+	void enter() { s_current = this; }
+	void leave() { s_current = nullptr; }
+
+public:
+	virtual ~Soft323xExecutor() = default;
+
+	/**
+	 * Returns the executor the calling coroutine is running on.
+	 */
+	static Soft323xExecutor &current() { return *s_current; }
+
+	/**
+	 * Resumes the given coroutine at virtual time t.
+	 */
+	virtual void schedule(std::coroutine_handle<> h, uint64_t t) = 0;
+
+	/**
+	 * Runs all coroutines until there is nothing left to do or the virtual
+	 * time reaches t_end.
+	 */
+	virtual void run(uint64_t t_end) = 0;
+};
+
+/**
+ * Executes all coroutines on the calling thread in the order of their virtual
+ * time.
+ */
+class Soft323xSingleThreadExecutor : public Soft323xExecutor {
+private:
+	Heap m_heap;
+	uint64_t m_seq = 0;
+
+public:
+	/**
+	 * Destroys the coroutines that were still waiting when run() returned.
+	 */
+	~Soft323xSingleThreadExecutor() override
+	{
+		while (!m_heap.empty()) {
+			m_heap.top().h.destroy();
+			m_heap.pop();
+		}
+	}
+
+	void schedule(std::coroutine_handle<> h, uint64_t t) override
+	{
+		m_heap.push(Item{t, m_seq++, h});
+	}
+
+	void run(uint64_t t_end) override
+	{
+		enter();
+		while (!m_heap.empty() && m_heap.top().t < t_end) {
+			const std::coroutine_handle<> h = m_heap.top().h;
+			m_heap.pop();
+			h.resume();
+		}
+		leave();
+	}
+};
+
+/**
+ * Executes the coroutines on a pool of worker threads. Virtual time advances
+ * in windows; all coroutines due within the current window are run in
+ * parallel, idle workers steal coroutines from the other workers' queues.
+ * Coroutines sleeping beyond the end of the window are kept in a per-worker
+ * heap until the window they are due in. Since devices do not interact,
+ * coroutines in the same window may run in any order.
+ */
+class Soft323xWorkStealingExecutor : public Soft323xExecutor {
+private:
+	struct alignas(64) Worker {
+		std::mutex mutex;
+		std::deque<std::coroutine_handle<>> ready;
+		Heap pending;
+		uint64_t seq = 0;
+	};
+
+	struct Completion {
+		Soft323xWorkStealingExecutor *self;
+		void operator()() noexcept { self->next_window(); }
+	};
+
+	static inline thread_local Worker *s_worker = nullptr;
+
+	std::vector<Worker> m_workers;
+	uint64_t m_window;
+	uint64_t m_window_end = 0;
+	uint64_t m_t_end = 0;
+	bool m_done = false;
+	std::atomic<int64_t> m_in_flight{0};
+	std::atomic<size_t> m_spawn_idx{0};
+
+	void push_ready(Worker &w, std::coroutine_handle<> h)
+	{
+		m_in_flight.fetch_add(1, std::memory_order_relaxed);
+		std::lock_guard<std::mutex> lock(w.mutex);
+		w.ready.push_back(h);
+	}
+
+	/**
+	 * Pops a coroutine from the back of the own queue or steals one from the
+	 * front of another worker's queue.
+	 */
+	std::coroutine_handle<> pop(size_t self)
+	{
+		{
+			Worker &w = m_workers[self];
+			std::lock_guard<std::mutex> lock(w.mutex);
+			if (!w.ready.empty()) {
+				const std::coroutine_handle<> h = w.ready.back();
+				w.ready.pop_back();
+				return h;
+			}
+		}
+		for (size_t i = 1; i < m_workers.size(); i++) {
+			Worker &w = m_workers[(self + i) % m_workers.size()];
+			std::lock_guard<std::mutex> lock(w.mutex);
+			if (!w.ready.empty()) {
+				const std::coroutine_handle<> h = w.ready.front();
+				w.ready.pop_front();
+				return h;
+			}
+		}
+		return nullptr;
+	}
+
+	/**
+	 * Advances the window to the next pending coroutine and moves all
+	 * coroutines due in the new window to the ready queues. Called by the
+	 * barrier once all workers finished the current window.
+	 */
+	void next_window() noexcept
+	{
+		uint64_t t_min = UINT64_MAX;
+		for (Worker &w : m_workers) {
+			if (!w.pending.empty()) {
+				t_min = std::min(t_min, w.pending.top().t);
+			}
+		}
+		m_done = (t_min >= m_t_end);
+		m_window_end =
+		    std::min(m_t_end, std::max(m_window_end, t_min) + m_window);
+		for (Worker &w : m_workers) {
+			while (!w.pending.empty() && w.pending.top().t < m_window_end) {
+				push_ready(w, w.pending.top().h);
+				w.pending.pop();
+			}
+		}
+	}
+
+	void work(size_t self, std::barrier<Completion> &barrier)
+	{
+		enter();
+		s_worker = &m_workers[self];
+		while (!m_done) {
+			// Run until no worker has anything left to do in this window
+			while (m_in_flight.load(std::memory_order_acquire) > 0) {
+				const std::coroutine_handle<> h = pop(self);
+				if (h) {
+					h.resume();
+					m_in_flight.fetch_sub(1, std::memory_order_release);
+				}
+				else {
+					std::this_thread::yield();
+				}
+			}
+			barrier.arrive_and_wait();
+		}
+		s_worker = nullptr;
+		leave();
+	}
+
+public:
+	/**
+	 * @param n_threads is the number of worker threads.
+	 * @param window is the length of the virtual time window in nanoseconds.
+	 */
+	explicit Soft323xWorkStealingExecutor(
+	    size_t n_threads = std::thread::hardware_concurrency(),
+	    uint64_t window = 1000000ULL)
+	    : m_workers(std::max<size_t>(1, n_threads)), m_window(window)
+	{
+	}
+
+	/**
+	 * Destroys the coroutines that were still waiting when run() returned.
+	 */
+	~Soft323xWorkStealingExecutor() override
+	{
+		for (Worker &w : m_workers) {
+			for (const std::coroutine_handle<> h : w.ready) {
+				h.destroy();
+			}
+			while (!w.pending.empty()) {
+				w.pending.top().h.destroy();
+				w.pending.pop();
+			}
+		}
+	}
+
+	void schedule(std::coroutine_handle<> h, uint64_t t) override
+	{
+		// Coroutines spawned from outside the executor are distributed
+		// round-robin
+		Worker &w = s_worker ? *s_worker
+		                     : m_workers[m_spawn_idx++ % m_workers.size()];
+		if (s_worker && t < m_window_end) {
+			push_ready(w, h);
+		}
+		else {
+			w.pending.push(Item{t, w.seq++, h});
+		}
+	}
+
+	void run(uint64_t t_end) override
+	{
+		m_t_end = t_end;
+		m_done = false;
+		next_window();
+		if (m_done) {
+			return;
+		}
+		std::barrier<Completion> barrier(m_workers.size(), Completion{this});
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < m_workers.size(); i++) {
+			threads.emplace_back([this, i, &barrier]() { work(i, barrier); });
+		}
+		work(0, barrier);
+		for (std::thread &t : threads) {
+			t.join();
+		}
+	}
+};
+
+/******************************************************************************
+ * Coroutine task                                                             *
+ ******************************************************************************/
+
+/**
+ * Fire-and-forget coroutine. The coroutine is started by spawn(); its frame
+ * is destroyed once it returns.
+ */
+class Soft323xTask {
+public:
+	struct promise_type {
+		Soft323xTask get_return_object()
+		{
+			return Soft323xTask(
+			    std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+
+private:
+	std::coroutine_handle<promise_type> m_handle;
+
+	explicit Soft323xTask(std::coroutine_handle<promise_type> h) : m_handle(h)
+	{
+	}
+
+public:
+	Soft323xTask(Soft323xTask &&o) noexcept : m_handle(o.m_handle)
+	{
+		o.m_handle = nullptr;
+	}
+	Soft323xTask(const Soft323xTask &) = delete;
+	Soft323xTask &operator=(const Soft323xTask &) = delete;
+
+	~Soft323xTask()
+	{
+		if (m_handle) {
+			m_handle.destroy();
+		}
+	}
+
+	/**
+	 * Starts the coroutine on the given executor at virtual time t.
+	 */
+	void spawn(Soft323xExecutor &executor, uint64_t t = 0) &&
+	{
+		executor.schedule(m_handle, t);
+		m_handle = nullptr;
+	}
+};
+
+/******************************************************************************
+ * Virtual device                                                             *
+ ******************************************************************************/
+
+/**
+ * A Soft323x instance with its own tick schedule and a virtual I2C bus.
+ */
+template <unsigned int SRAM_SIZE = 0, typename Config = Soft323xDefaultConfig>
+class Soft323xDevice {
+public:
+	using RTC = Soft323x<SRAM_SIZE, Config>;
+
+private:
+	RTC m_rtc;
+	uint64_t m_now;
+	uint64_t m_next_tick;
+	uint64_t m_tick_period;
+	uint64_t m_byte_time;
+
+	/**
+	 * Applies all ticks due at the current virtual time.
+	 */
+	void catch_up()
+	{
+		uint8_t n = 0;
+		while (m_next_tick <= m_now) {
+			m_rtc.tick();
+			m_next_tick += m_tick_period;
+			if (++n == 0xFF) {
+				m_rtc.update();
+				n = 0;
+			}
+		}
+		m_rtc.update();
+	}
+
+	/**
+	 * Suspends the calling coroutine until the given virtual time.
+	 */
+	struct SleepAwaiter {
+		Soft323xDevice &dev;
+		uint64_t t;
+
+		bool await_ready() const noexcept { return t <= dev.m_now; }
+		void await_suspend(std::coroutine_handle<> h) const
+		{
+			Soft323xExecutor::current().schedule(h, t);
+		}
+		void await_resume() const
+		{
+			dev.m_now = std::max(dev.m_now, t);
+			dev.catch_up();
+		}
+	};
+
+	/**
+	 * Performs an I2C burst transfer after the bus time has passed.
+	 */
+	struct BurstAwaiter : public SleepAwaiter {
+		uint8_t addr;
+		uint8_t *rd;
+		const uint8_t *wr;
+		uint8_t n;
+
+		void await_resume() const
+		{
+			SleepAwaiter::await_resume();
+			RTC &rtc = this->dev.m_rtc;
+			uint8_t a = addr;
+			for (uint8_t i = 0; i < n; i++) {
+				if (rd) {
+					rd[i] = rtc.i2c_read(a);
+				}
+				else if (rtc.i2c_write(a, wr[i]) & rtc.ACTION_RESET_TIMER) {
+					this->dev.m_next_tick = this->t + this->dev.m_tick_period;
+				}
+				a = rtc.i2c_next_addr(a);
+			}
+			rtc.update();
+		}
+	};
+
+public:
+	/**
+	 * @param tick_period is the period of the second timer in nanoseconds.
+	 * @param phase is the virtual time of the first tick.
+	 * @param f_scl is the I2C clock in Hz; one byte takes nine clock cycles.
+	 */
+	explicit Soft323xDevice(uint64_t tick_period = 1000000000ULL,
+	                        uint64_t phase = 1000000000ULL,
+	                        uint32_t f_scl = 400000)
+	    : m_now(0),
+	      m_next_tick(phase),
+	      m_tick_period(tick_period),
+	      m_byte_time(9000000000ULL / f_scl)
+	{
+	}
+
+	RTC &rtc() { return m_rtc; }
+	const RTC &rtc() const { return m_rtc; }
+	uint64_t now() const { return m_now; }
+
+	/**
+	 * Waits for the given number of nanoseconds of virtual time.
+	 */
+	SleepAwaiter sleep_for(uint64_t dt) { return SleepAwaiter{*this, m_now + dt}; }
+
+	/**
+	 * Waits until the next tick of the device and applies it.
+	 */
+	SleepAwaiter tick() { return SleepAwaiter{*this, m_next_tick}; }
+
+	/**
+	 * Reads n registers starting at addr into buf. Completes after the time
+	 * required for the transaction (address byte, register byte, repeated
+	 * start with address byte, n data bytes) has passed.
+	 */
+	BurstAwaiter read_burst(uint8_t addr, uint8_t *buf, uint8_t n)
+	{
+		return BurstAwaiter{
+		    {*this, m_now + (3U + n) * m_byte_time}, addr, buf, nullptr, n};
+	}
+
+	/**
+	 * Writes n registers starting at addr.
+	 */
+	BurstAwaiter write_burst(uint8_t addr, const uint8_t *buf, uint8_t n)
+	{
+		return BurstAwaiter{
+		    {*this, m_now + (2U + n) * m_byte_time}, addr, nullptr, buf, n};
+	}
+};
+
+#endif /* SOFT323X_CORO_HPP */
@@ -0,0 +1,195 @@
+/**
+ *  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Probe policies for measuring the execution time of the hot paths of
+ * Soft323x, selected by Config::Probe. Soft323xProbeAvrGpio toggles a pin for
+ * a logic analyser; Soft323xProbeCycles records per-path statistics using a
+ * cycle counter, either the DWT cycle counter on Cortex-M (Soft323xCyclesDwt)
+ * or the time stamp counter on x86 (Soft323xCyclesTsc).
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef SOFT323X_PROBE_HPP
+#define SOFT323X_PROBE_HPP
+
+#include "soft323x.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#if __AVR__
+/**
+ * Toggles a GPIO pin on entry and exit of the selected paths by writing to
+ * the PINx register, so the pulses seen by a logic analyser are as long as
+ * the paths take to execute. Nested paths toggle the pin again; use PATHS to
+ * select the paths of interest.
+ *
+ * @tparam PIN is the data memory address of the PINx register, e.g. 0x23 for
+ * PINB on the ATmega168.
+ * @tparam MASK is the bit mask of the pin within the port.
+ * @tparam PATHS is a bit mask of the instrumented paths, where bit i
+ * corresponds to the Soft323xProbePath identifier i.
+ */
+template <uint8_t PIN, uint8_t MASK, uint8_t PATHS = 0xFF>
+struct Soft323xProbeAvrGpio {
+	static void begin(uint8_t path)
+	{
+		if (PATHS & (1U << path)) {
+			*(volatile uint8_t *)PIN = MASK;
+		}
+	}
+
+	static void end(uint8_t path) { begin(path); }
+};
+#endif
+
+#if defined(__arm__) && defined(__ARM_ARCH_PROFILE) && \
+    __ARM_ARCH_PROFILE == 'M'
+/**
+ * Cycle counter of the DWT unit. Not present on ARMv6-M (Cortex-M0/M0+).
+ * enable() must be called once before the first measurement.
+ */
+struct Soft323xCyclesDwt {
+	static void enable()
+	{
+		*(volatile uint32_t *)0xE000EDFCUL |= (1UL << 24U);  // DEMCR.TRCENA
+		*(volatile uint32_t *)0xE0001004UL = 0U;             // DWT_CYCCNT
+		*(volatile uint32_t *)0xE0001000UL |= 1UL;  // DWT_CTRL.CYCCNTENA
+	}
+
+	static uint32_t now() { return *(volatile uint32_t *)0xE0001004UL; }
+};
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * Time stamp counter of x86 CPUs. On current CPUs this counts at a constant
+ * reference rate rather than in core clock cycles.
+ */
+struct Soft323xCyclesTsc {
+	static uint32_t now() { return uint32_t(__rdtsc()); }
+};
+#endif
+
+/**
+ * Records the number of cycles spent in each path: the number of calls, the
+ * minimum, maximum and sum, and a histogram with power-of-two buckets. Only
+ * the outermost of nested calls of the same path is measured. The counts
+ * include the overhead of reading the counter once. The statistics are kept
+ * in static memory shared by all instances using the policy; they must not
+ * be updated concurrently, i.e. the paths of interest must not run in
+ * parallel on several threads.
+ *
+ * @tparam Cycles provides the static function now() returning a free-running
+ * 32-bit cycle counter.
+ */
+template <typename Cycles>
+struct Soft323xProbeCycles {
+	/**
+	 * Number of histogram buckets. Bucket i counts durations d with
+	 * 2^i <= d < 2^(i + 1); bucket zero also counts d = 0.
+	 */
+	static constexpr uint8_t HIST_SIZE = 32;
+
+	struct Stat {
+		uint32_t count;
+		uint32_t min;
+		uint32_t max;
+		uint64_t sum;
+		uint32_t hist[HIST_SIZE];
+	};
+
+	struct State {
+		Stat stat[Soft323xProbePath::COUNT];
+		uint32_t start[Soft323xProbePath::COUNT];
+		uint8_t depth[Soft323xProbePath::COUNT];
+	};
+
+	static State s_state;
+
+	static void begin(uint8_t path)
+	{
+		if (s_state.depth[path]++ == 0U) {
+			s_state.start[path] = Cycles::now();
+		}
+	}
+
+	static void end(uint8_t path)
+	{
+		if (--s_state.depth[path] == 0U) {
+			record(s_state.stat[path], Cycles::now() - s_state.start[path]);
+		}
+	}
+
+	/**
+	 * Adds a single measurement to the given statistics.
+	 */
+	static void record(Stat &s, uint32_t d)
+	{
+		s.min = (s.count == 0U || d < s.min) ? d : s.min;
+		s.max = (d > s.max) ? d : s.max;
+		s.count++;
+		s.sum += d;
+		uint8_t bucket = 0U;
+		while (bucket < HIST_SIZE - 1U && (d >> (bucket + 1U))) {
+			bucket++;
+		}
+		s.hist[bucket]++;
+	}
+
+	/**
+	 * Returns the statistics of the given path.
+	 */
+	static const Stat &stat(uint8_t path) { return s_state.stat[path]; }
+
+	/**
+	 * Returns an upper bound of the duration below which the given fraction
+	 * of the calls of a path completed, according to the histogram.
+	 */
+	static uint32_t percentile(uint8_t path, double q)
+	{
+		const Stat &s = s_state.stat[path];
+		uint64_t n = 0U;
+		for (uint8_t i = 0U; i < HIST_SIZE; i++) {
+			n += s.hist[i];
+			if (n >= q * s.count) {
+				const uint32_t bound = (i + 1U < 32U) ? (2UL << i) - 1U : ~0UL;
+				return (bound < s.max) ? bound : s.max;
+			}
+		}
+		return s.max;
+	}
+
+	/**
+	 * Clears the statistics of all paths.
+	 */
+	static void reset()
+	{
+		for (uint8_t i = 0U; i < Soft323xProbePath::COUNT; i++) {
+			s_state.stat[i] = Stat();
+		}
+	}
+};
+
+template <typename Cycles>
+typename Soft323xProbeCycles<Cycles>::State Soft323xProbeCycles<Cycles>::s_state;
+
+#endif /* SOFT323X_PROBE_HPP */
@@ -0,0 +1,345 @@
+/**
+ *  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Hosted mode in which a Soft323x instance lives in a memory-mapped file
+ * (e.g. in /dev/shm) shared by multiple processes. A single writer process
+ * advances the clock and publishes an image of the register bank; any number
+ * of reader processes read the image without locks using a sequence lock.
+ * Since the Soft323x object itself is stored in the file, its state survives
+ * restarts of the writer.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef SOFT323X_SHM_HPP
+#define SOFT323X_SHM_HPP
+
+#include "soft323x.hpp"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <new>
+
+/**
+ * Layout of the shared memory segment.
+ */
+template <typename RTC>
+struct Soft323xShmSegment {
+	static constexpr uint32_t MAGIC = 0x33323353;  // "S323"
+	static constexpr unsigned int IMAGE_WORDS = 256 / 8;
+	static constexpr unsigned int BOOT_ID_SIZE = 40;
+
+	uint32_t magic;
+	uint32_t size;
+
+	/**
+	 * Sequence counter of the register image. Odd while the writer updates
+	 * the image.
+	 */
+	std::atomic<uint32_t> seq;
+
+	/**
+	 * Image of the 256 addressable registers, as returned by i2c_read().
+	 */
+	std::atomic<uint64_t> image[IMAGE_WORDS];
+
+	/**
+	 * CLOCK_MONOTONIC time in nanoseconds at which the image was published.
+	 */
+	std::atomic<uint64_t> published;
+
+	/**
+	 * State only accessed by the writer.
+	 */
+	uint64_t origin;  // CLOCK_MONOTONIC time of the last timer reset
+	uint64_t ticks;   // Ticks applied since origin
+	char boot_id[BOOT_ID_SIZE];  // Kernel boot ID the origin refers to
+	RTC rtc;
+};
+
+/**
+ * Base class mapping the shared memory segment.
+ */
+template <typename RTC>
+class Soft323xShmMapping {
+public:
+	using Segment = Soft323xShmSegment<RTC>;
+
+protected:
+	int m_fd = -1;
+	Segment *m_seg = nullptr;
+
+	static uint64_t monotonic_ns()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return uint64_t(ts.tv_sec) * 1000000000ULL + uint64_t(ts.tv_nsec);
+	}
+
+	/**
+	 * Reads the kernel boot ID, which changes with every reboot. The ID is
+	 * left empty if it is not available.
+	 */
+	static void read_boot_id(char (&id)[Segment::BOOT_ID_SIZE])
+	{
+		memset(id, 0, sizeof(id));
+		const int fd = ::open("/proc/sys/kernel/random/boot_id", O_RDONLY);
+		if (fd >= 0) {
+			if (::read(fd, id, sizeof(id) - 1U) < 0) {
+				memset(id, 0, sizeof(id));
+			}
+			::close(fd);
+		}
+	}
+
+	bool map(const char *path, bool writable)
+	{
+		m_fd = ::open(path, writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+		if (m_fd < 0) {
+			return false;
+		}
+		if (writable) {
+			// Only a single writer is allowed
+			if (flock(m_fd, LOCK_EX | LOCK_NB) < 0 ||
+			    ftruncate(m_fd, sizeof(Segment)) < 0) {
+				return false;
+			}
+		}
+		else {
+			struct stat st;
+			if (fstat(m_fd, &st) < 0 || size_t(st.st_size) < sizeof(Segment)) {
+				return false;
+			}
+		}
+		void *p = mmap(nullptr, sizeof(Segment),
+		               writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+		               MAP_SHARED, m_fd, 0);
+		if (p == MAP_FAILED) {
+			return false;
+		}
+		m_seg = static_cast<Segment *>(p);
+		return true;
+	}
+
+	Soft323xShmMapping() = default;
+
+	~Soft323xShmMapping()
+	{
+		if (m_seg) {
+			munmap(m_seg, sizeof(Segment));
+		}
+		if (m_fd >= 0) {
+			::close(m_fd);  // Also releases the writer lock
+		}
+	}
+
+public:
+	Soft323xShmMapping(const Soft323xShmMapping &) = delete;
+	Soft323xShmMapping &operator=(const Soft323xShmMapping &) = delete;
+
+	/**
+	 * Returns true if the segment was mapped successfully.
+	 */
+	bool ok() const { return m_seg != nullptr; }
+};
+
+/**
+ * Process owning the Soft323x instance in the shared memory segment. Call
+ * sync() periodically (at least once per second) to advance the clock and
+ * publish the register image.
+ */
+template <unsigned int SRAM_SIZE = 0, typename Config = Soft323xDefaultConfig>
+class Soft323xShmWriter
+    : public Soft323xShmMapping<Soft323x<SRAM_SIZE, Config>> {
+public:
+	using RTC = Soft323x<SRAM_SIZE, Config>;
+	using Base = Soft323xShmMapping<RTC>;
+	using Segment = typename Base::Segment;
+
+private:
+	static constexpr uint64_t NS_PER_TICK = 1000000000ULL;
+
+	void apply_ticks(uint64_t now)
+	{
+		Segment &s = *this->m_seg;
+		if (now < s.origin) {
+			// The monotonic clock was reset (reboot without a boot ID), start
+			// a new second
+			s.origin = now;
+			s.ticks = 0;
+		}
+		const uint64_t target = (now - s.origin) / NS_PER_TICK;
+		while (s.ticks < target) {
+			const uint64_t n = target - s.ticks;
+			const uint8_t k = (n > 0xFF) ? 0xFF : uint8_t(n);
+			for (uint8_t i = 0; i < k; i++) {
+				s.rtc.tick();
+			}
+			s.rtc.update();
+			s.ticks += k;
+		}
+	}
+
+public:
+	/**
+	 * Opens or creates the segment at the given path. The Soft323x instance
+	 * is only initialised if the file does not contain a valid segment. If
+	 * a previous writer crashed during publish(), the sequence number is
+	 * left odd; it is rounded up so that readers do not wait forever. If the
+	 * system was rebooted since the segment was last written, CLOCK_MONOTONIC
+	 * has restarted and the clock continues from the stored time.
+	 */
+	explicit Soft323xShmWriter(const char *path)
+	{
+		if (!this->map(path, true)) {
+			return;
+		}
+		Segment &s = *this->m_seg;
+		char boot_id[Segment::BOOT_ID_SIZE];
+		Base::read_boot_id(boot_id);
+		if (s.magic != Segment::MAGIC || s.size != sizeof(Segment)) {
+			s.seq.store(0, std::memory_order_relaxed);
+			s.origin = Base::monotonic_ns();
+			s.ticks = 0;
+			memcpy(s.boot_id, boot_id, sizeof(boot_id));
+			new (&s.rtc) RTC();
+			s.size = sizeof(Segment);
+			s.magic = Segment::MAGIC;
+		}
+		else {
+			const uint32_t seq = s.seq.load(std::memory_order_relaxed);
+			s.seq.store((seq + 1U) & ~1U, std::memory_order_relaxed);
+			if (memcmp(s.boot_id, boot_id, sizeof(boot_id)) != 0) {
+				s.origin = Base::monotonic_ns();
+				s.ticks = 0;
+				memcpy(s.boot_id, boot_id, sizeof(boot_id));
+			}
+		}
+		sync();
+	}
+
+	RTC &rtc() { return this->m_seg->rtc; }
+
+	/**
+	 * Applies the ticks elapsed since the last call and publishes the
+	 * register image.
+	 */
+	void sync()
+	{
+		const uint64_t now = Base::monotonic_ns();
+		apply_ticks(now);
+		publish(now);
+	}
+
+	/**
+	 * Writes a register as an I2C master would and publishes the result.
+	 * Writing the seconds register restarts the current second.
+	 */
+	void i2c_write(uint8_t addr, uint8_t value)
+	{
+		Segment &s = *this->m_seg;
+		const uint64_t now = Base::monotonic_ns();
+		apply_ticks(now);
+		if (s.rtc.i2c_write(addr, value) & RTC::ACTION_RESET_TIMER) {
+			s.origin = now;
+			s.ticks = 0;
+		}
+		s.rtc.update();
+		publish(now);
+	}
+
+	/**
+	 * Copies the current register bank into the image.
+	 */
+	void publish(uint64_t now)
+	{
+		Segment &s = *this->m_seg;
+		const uint32_t seq = s.seq.load(std::memory_order_relaxed);
+		s.seq.store(seq + 1U, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for (unsigned int i = 0; i < Segment::IMAGE_WORDS; i++) {
+			uint64_t word = 0;
+			for (unsigned int j = 0; j < 8; j++) {
+				word |= uint64_t(s.rtc.i2c_read(uint8_t(i * 8 + j))) << (8 * j);
+			}
+			s.image[i].store(word, std::memory_order_relaxed);
+		}
+		s.published.store(now, std::memory_order_relaxed);
+		s.seq.store(seq + 2U, std::memory_order_release);
+	}
+};
+
+/**
+ * Process reading the register image published by the writer.
+ */
+template <unsigned int SRAM_SIZE = 0, typename Config = Soft323xDefaultConfig>
+class Soft323xShmReader
+    : public Soft323xShmMapping<Soft323x<SRAM_SIZE, Config>> {
+public:
+	using RTC = Soft323x<SRAM_SIZE, Config>;
+	using Base = Soft323xShmMapping<RTC>;
+	using Segment = typename Base::Segment;
+
+	/**
+	 * Opens an existing segment created by a writer.
+	 */
+	explicit Soft323xShmReader(const char *path)
+	{
+		if (this->map(path, false) &&
+		    (this->m_seg->magic != Segment::MAGIC ||
+		     this->m_seg->size != sizeof(Segment))) {
+			munmap(this->m_seg, sizeof(Segment));
+			this->m_seg = nullptr;
+		}
+	}
+
+	/**
+	 * Reads n consecutive registers starting at addr into buf. Returns the
+	 * CLOCK_MONOTONIC time at which the data was published. The registers
+	 * are read consistently, i.e. never from two different publications.
+	 */
+	uint64_t read(uint8_t addr, uint8_t *buf, unsigned int n) const
+	{
+		const Segment &s = *this->m_seg;
+		uint32_t seq0, seq1;
+		uint64_t published;
+		do {
+			seq0 = s.seq.load(std::memory_order_acquire);
+			for (unsigned int i = 0; i < n; i++) {
+				const uint8_t a = uint8_t(addr + i);
+				buf[i] = uint8_t(
+				    s.image[a / 8].load(std::memory_order_relaxed) >>
+				    (8 * (a % 8)));
+			}
+			published = s.published.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			seq1 = s.seq.load(std::memory_order_relaxed);
+		} while ((seq0 & 1U) || seq0 != seq1);
+		return published;
+	}
+};
+
+#endif /* SOFT323X_SHM_HPP */
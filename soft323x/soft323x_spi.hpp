@@ -0,0 +1,201 @@
+/**
+ *  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * SPI slave transport emulating the register interface of the DS3234, the SPI
+ * variant of the DS3232. The first byte of each transfer is the register
+ * address; bit 7 is set for writes. Registers 00h-13h are the same as over
+ * I2C. The SRAM is accessed indirectly: 18h holds the SRAM address, 19h reads
+ * or writes the SRAM byte at that address and increments the address.
+ *
+ * See https://datasheets.maximintegrated.com/en/ds/DS3234.pdf for more
+ * information.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef SOFT323X_SPI_HPP
+#define SOFT323X_SPI_HPP
+
+#include "soft323x.hpp"
+
+/**
+ * Byte-oriented SPI slave state machine operating on a Soft323x instance.
+ * select() and deselect() should be called on the edges of the chip select
+ * line, transfer() whenever a byte has been shifted in. As on the I2C bus,
+ * update() must not be called by the main loop while active() is true.
+ *
+ * The SRAM address register maps to the I2C address space relative to the
+ * beginning of the SRAM (14h), i.e. SRAM address 00h is the first SRAM byte.
+ * Extension registers can be reached the same way; the SRAM address wraps at
+ * FFh.
+ */
+template <typename RTC>
+class Soft323xSpi {
+public:
+	static constexpr uint8_t BIT_WRITE = 0x80;
+	static constexpr uint8_t REG_SRAM_ADDR = 0x18;
+	static constexpr uint8_t REG_SRAM_DATA = 0x19;
+
+private:
+	RTC &m_rtc;
+	uint8_t m_addr;       // Current register address
+	uint8_t m_sram_addr;  // SRAM address register (18h)
+	uint8_t m_actions;    // Actions not yet consumed
+	bool m_active;        // Chip select is asserted
+	bool m_has_addr;      // The address byte was received
+	bool m_write;         // The current transfer is a write
+
+	uint8_t read_reg(uint8_t addr) const
+	{
+		if (addr <= RTC::REG_CTRL_3) {
+			return m_rtc.i2c_read(addr);
+		}
+		if (addr == REG_SRAM_ADDR) {
+			return m_sram_addr;
+		}
+		if (addr == REG_SRAM_DATA) {
+			return m_rtc.i2c_read(uint8_t(RTC::REG_SRAM + m_sram_addr));
+		}
+		return 0U;
+	}
+
+	void write_reg(uint8_t addr, uint8_t value)
+	{
+		if (addr <= RTC::REG_CTRL_3) {
+			m_actions |= m_rtc.i2c_write(addr, value);
+		}
+		else if (addr == REG_SRAM_ADDR) {
+			m_sram_addr = value;
+		}
+		else if (addr == REG_SRAM_DATA) {
+			m_actions |=
+			    m_rtc.i2c_write(uint8_t(RTC::REG_SRAM + m_sram_addr), value);
+		}
+	}
+
+	/**
+	 * Advances to the next register after a byte was transferred. The SRAM
+	 * data register increments the SRAM address instead. Registers 00h-13h
+	 * wrap around to 00h, in which case the clock is updated like in
+	 * Soft323x::i2c_next_addr().
+	 */
+	void next()
+	{
+		if (m_addr == REG_SRAM_DATA) {
+			m_sram_addr++;
+			return;
+		}
+		m_addr = (m_addr == RTC::REG_CTRL_3 || m_addr == 0x7FU)
+		             ? 0U
+		             : uint8_t(m_addr + 1U);
+		if (m_addr == 0U) {
+			m_rtc.update();
+		}
+	}
+
+public:
+	explicit Soft323xSpi(RTC &rtc)
+	    : m_rtc(rtc),
+	      m_addr(0U),
+	      m_sram_addr(0U),
+	      m_actions(0U),
+	      m_active(false),
+	      m_has_addr(false),
+	      m_write(false)
+	{
+	}
+
+	/**
+	 * Must be called when the chip select line is asserted. Commits the
+	 * ticks collected so far, just like an I2C start condition.
+	 */
+	void select()
+	{
+		m_active = true;
+		m_has_addr = false;
+		m_actions = 0U;
+		m_rtc.update();
+	}
+
+	/**
+	 * Processes a byte received from the master and returns the byte that
+	 * should be shifted out during the next byte. On an AVR, this is meant to
+	 * be called from the SPI ISR as SPDR = spi.transfer(SPDR).
+	 *
+	 * @param mosi is the byte received from the master.
+	 * @return the byte that should be sent to the master next.
+	 */
+	uint8_t transfer(uint8_t mosi)
+	{
+		if (!m_active) {
+			return 0U;
+		}
+		if (!m_has_addr) {
+			m_has_addr = true;
+			m_write = mosi & BIT_WRITE;
+			m_addr = mosi & ~BIT_WRITE;
+			return m_write ? 0U : read_reg(m_addr);
+		}
+		if (m_write) {
+			write_reg(m_addr, mosi);
+			next();
+			return 0U;
+		}
+
+		// The byte prefetched by the last call has been shifted out
+		next();
+		return read_reg(m_addr);
+	}
+
+	/**
+	 * Returns the actions requested by the registers written since select()
+	 * or the last call and clears them. Should be called after each
+	 * transfer(), so that the second timer is reset right after the seconds
+	 * register was written, as on the I2C bus. Otherwise, a tick arriving
+	 * during the rest of a burst write is counted in the wrong second.
+	 *
+	 * @return a combination of Soft323x::ACTION_RESET_TIMER and
+	 * ACTION_CONVERT_TEMPERATURE.
+	 */
+	uint8_t consume_actions()
+	{
+		const uint8_t res = m_actions;
+		m_actions = 0U;
+		return res;
+	}
+
+	/**
+	 * Must be called when the chip select line is deasserted.
+	 *
+	 * @return the actions requested by the written registers that were not
+	 * consumed by consume_actions() yet.
+	 */
+	uint8_t deselect()
+	{
+		m_active = false;
+		return consume_actions();
+	}
+
+	/**
+	 * Returns true while the chip select line is asserted.
+	 */
+	bool active() const { return m_active; }
+};
+
+#endif /* SOFT323X_SPI_HPP */
@@ -0,0 +1,414 @@
+/**
+ *  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Compact binary trace format for the events seen by a Soft323x instance
+ * (ticks, main loop updates, I2C start and stop conditions, register reads and
+ * writes) and a reader replaying a memory-mapped trace file.
+ *
+ * A trace starts with the eight-byte magic "S323TRC\x01", followed by the
+ * events. Each event starts with a tag byte; the lower three bits are the
+ * event type, the upper five bits an immediate value. An immediate of 31
+ * means that the value is stored after the tag:
+ *
+ * - TICK: the immediate is the number of ticks, larger values are stored as
+ *   31 plus an unsigned LEB128 varint.
+ * - UPDATE, START, STOP: no immediate.
+ * - WRITE, READ: the immediate is the zigzag-encoded difference between the
+ *   register address and the address following the last access, i.e. zero
+ *   for bursts. Other addresses are stored as a raw byte. The tag is followed
+ *   by the value written or read.
+ *
+ * Replaying a read compares the value returned by the device with the value
+ * in the trace.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef SOFT323X_TRACE_HPP
+#define SOFT323X_TRACE_HPP
+
+#include "soft323x.hpp"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Constants shared by the trace writer and reader.
+ */
+struct Soft323xTrace {
+	static constexpr size_t MAGIC_SIZE = 8;
+
+	static constexpr uint8_t EV_TICK = 0;
+	static constexpr uint8_t EV_UPDATE = 1;
+	static constexpr uint8_t EV_START = 2;
+	static constexpr uint8_t EV_STOP = 3;
+	static constexpr uint8_t EV_WRITE = 4;
+	static constexpr uint8_t EV_READ = 5;
+
+	static constexpr uint8_t IMM_EXT = 31;
+
+	/**
+	 * Returns the i-th byte of the magic at the beginning of the file.
+	 */
+	static constexpr uint8_t magic(size_t i)
+	{
+		return uint8_t("S323TRC\x01"[i]);
+	}
+};
+
+/**
+ * Writes events to a trace file through a buffer.
+ */
+class Soft323xTraceWriter {
+private:
+	static constexpr size_t BUF_SIZE = 65536;
+
+	FILE *m_file;
+	uint8_t m_buf[BUF_SIZE];
+	size_t m_len;
+	uint8_t m_next_addr;
+	uint32_t m_ticks;  // Ticks not yet written
+
+	void put(uint8_t byte)
+	{
+		if (m_len == BUF_SIZE) {
+			flush();
+		}
+		m_buf[m_len++] = byte;
+	}
+
+	void put_tag(uint8_t type, uint8_t imm)
+	{
+		put(uint8_t(type | (imm << 3U)));
+	}
+
+	void put_ticks()
+	{
+		uint32_t n = m_ticks;
+		m_ticks = 0;
+		if (n < Soft323xTrace::IMM_EXT) {
+			put_tag(Soft323xTrace::EV_TICK, uint8_t(n));
+			return;
+		}
+		put_tag(Soft323xTrace::EV_TICK, Soft323xTrace::IMM_EXT);
+		n -= Soft323xTrace::IMM_EXT;
+		while (n >= 0x80U) {
+			put(uint8_t(n | 0x80U));
+			n >>= 7U;
+		}
+		put(uint8_t(n));
+	}
+
+	void put_event(uint8_t type)
+	{
+		if (m_ticks) {
+			put_ticks();
+		}
+		put_tag(type, 0);
+	}
+
+	void put_access(uint8_t type, uint8_t addr, uint8_t value)
+	{
+		if (m_ticks) {
+			put_ticks();
+		}
+		const int8_t delta = int8_t(uint8_t(addr - m_next_addr));
+		const uint8_t zigzag = uint8_t((delta << 1) ^ (delta >> 7));
+		if (zigzag < Soft323xTrace::IMM_EXT) {
+			put_tag(type, zigzag);
+		}
+		else {
+			put_tag(type, Soft323xTrace::IMM_EXT);
+			put(addr);
+		}
+		put(value);
+		m_next_addr = uint8_t(addr + 1U);
+	}
+
+public:
+	/**
+	 * Creates the trace file at the given path.
+	 */
+	explicit Soft323xTraceWriter(const char *path)
+	    : m_file(fopen(path, "wb")), m_len(0), m_next_addr(0), m_ticks(0)
+	{
+		for (size_t i = 0; i < Soft323xTrace::MAGIC_SIZE; i++) {
+			put(Soft323xTrace::magic(i));
+		}
+	}
+
+	~Soft323xTraceWriter()
+	{
+		if (m_file) {
+			flush();
+			fclose(m_file);
+		}
+	}
+
+	Soft323xTraceWriter(const Soft323xTraceWriter &) = delete;
+	Soft323xTraceWriter &operator=(const Soft323xTraceWriter &) = delete;
+
+	bool ok() const { return m_file != nullptr; }
+
+	/**
+	 * Records n calls to tick(). Consecutive ticks are merged into a single
+	 * event.
+	 */
+	void tick(uint32_t n = 1)
+	{
+		if (m_ticks > 0xFFFFFFFFUL - n) {
+			put_ticks();
+		}
+		m_ticks += n;
+	}
+
+	/**
+	 * Records a call to update() by the main loop.
+	 */
+	void update() { put_event(Soft323xTrace::EV_UPDATE); }
+
+	/**
+	 * Records an I2C start condition (or a repeated start).
+	 */
+	void start() { put_event(Soft323xTrace::EV_START); }
+
+	/**
+	 * Records an I2C stop condition.
+	 */
+	void stop() { put_event(Soft323xTrace::EV_STOP); }
+
+	/**
+	 * Records a register write.
+	 */
+	void write(uint8_t addr, uint8_t value)
+	{
+		put_access(Soft323xTrace::EV_WRITE, addr, value);
+	}
+
+	/**
+	 * Records a register read and the value returned.
+	 */
+	void read(uint8_t addr, uint8_t value)
+	{
+		put_access(Soft323xTrace::EV_READ, addr, value);
+	}
+
+	/**
+	 * Writes all buffered events to the file.
+	 */
+	void flush()
+	{
+		if (m_ticks) {
+			put_ticks();
+		}
+		if (m_file && m_len) {
+			fwrite(m_buf, 1, m_len, m_file);
+			fflush(m_file);
+		}
+		m_len = 0;
+	}
+};
+
+/**
+ * Maps a trace file into memory and replays it. The events are decoded in
+ * place, without copying the file.
+ */
+class Soft323xTraceReader {
+public:
+	/**
+	 * Statistics of a replay.
+	 */
+	struct Result {
+		uint64_t events = 0;
+		uint64_t ticks = 0;
+		uint64_t mismatches = 0;  // Reads returning a different value
+		int64_t first_mismatch = -1;  // File offset of the first mismatch
+		bool invalid = false;  // Truncated event or unknown event type
+	};
+
+private:
+	int m_fd;
+	const uint8_t *m_data;
+	size_t m_size;
+	bool m_mapped;
+
+	bool check_magic() const
+	{
+		if (m_size < Soft323xTrace::MAGIC_SIZE) {
+			return false;
+		}
+		for (size_t i = 0; i < Soft323xTrace::MAGIC_SIZE; i++) {
+			if (m_data[i] != Soft323xTrace::magic(i)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+public:
+	/**
+	 * Maps the trace file at the given path.
+	 */
+	explicit Soft323xTraceReader(const char *path)
+	    : m_fd(::open(path, O_RDONLY)),
+	      m_data(nullptr),
+	      m_size(0),
+	      m_mapped(false)
+	{
+		struct stat st;
+		if (m_fd < 0 || fstat(m_fd, &st) < 0 || st.st_size == 0) {
+			return;
+		}
+		void *p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE,
+		               m_fd, 0);
+		if (p == MAP_FAILED) {
+			return;
+		}
+		madvise(p, size_t(st.st_size), MADV_SEQUENTIAL);
+		m_data = static_cast<const uint8_t *>(p);
+		m_size = size_t(st.st_size);
+		m_mapped = true;
+	}
+
+	/**
+	 * Reads a trace from memory. The data must stay valid while the reader
+	 * is used.
+	 */
+	Soft323xTraceReader(const uint8_t *data, size_t size)
+	    : m_fd(-1), m_data(data), m_size(size), m_mapped(false)
+	{
+	}
+
+	~Soft323xTraceReader()
+	{
+		if (m_mapped) {
+			munmap(const_cast<uint8_t *>(m_data), m_size);
+		}
+		if (m_fd >= 0) {
+			::close(m_fd);
+		}
+	}
+
+	Soft323xTraceReader(const Soft323xTraceReader &) = delete;
+	Soft323xTraceReader &operator=(const Soft323xTraceReader &) = delete;
+
+	/**
+	 * Returns true if the trace was mapped and starts with the magic.
+	 */
+	bool ok() const { return m_data != nullptr && check_magic(); }
+
+	/**
+	 * Size of the trace in bytes.
+	 */
+	size_t size() const { return m_size; }
+
+	/**
+	 * Replays the trace on the given device. The calls are the same the AVR
+	 * example makes: tick() for ticks, update() for main loop updates and
+	 * start conditions, i2c_read() or i2c_write() followed by i2c_next_addr()
+	 * for register accesses. Tick events longer than 255 seconds are split,
+	 * calling update() in between.
+	 */
+	template <typename RTC>
+	Result replay(RTC &rtc) const
+	{
+		Result res;
+		if (!ok()) {
+			return res;
+		}
+		const uint8_t *p = m_data + Soft323xTrace::MAGIC_SIZE;
+		const uint8_t *const end = m_data + m_size;
+		uint8_t next_addr = 0;
+		while (p < end) {
+			const uint8_t *const ev = p;
+			const uint8_t tag = *p++;
+			const uint8_t imm = tag >> 3U;
+			res.events++;
+			switch (tag & 0x07U) {
+				case Soft323xTrace::EV_TICK: {
+					uint64_t n = imm;
+					if (imm == Soft323xTrace::IMM_EXT) {
+						uint64_t v = 0;
+						unsigned int shift = 0;
+						do {
+							if (p == end || shift > 28) {
+								res.invalid = true;
+								return res;
+							}
+							v |= uint64_t(*p & 0x7FU) << shift;
+							shift += 7;
+						} while (*p++ & 0x80U);
+						n += v;
+					}
+					res.ticks += n;
+					while (n > 0) {
+						const uint8_t k = (n > 255U) ? 255U : uint8_t(n);
+						for (uint8_t i = 0; i < k; i++) {
+							rtc.tick();
+						}
+						n -= k;
+						if (n > 0) {
+							rtc.update();
+						}
+					}
+					break;
+				}
+				case Soft323xTrace::EV_UPDATE:
+				case Soft323xTrace::EV_START:
+					rtc.update();
+					break;
+				case Soft323xTrace::EV_STOP:
+					break;
+				case Soft323xTrace::EV_WRITE:
+				case Soft323xTrace::EV_READ: {
+					const size_t need = (imm == Soft323xTrace::IMM_EXT) ? 2 : 1;
+					if (size_t(end - p) < need) {
+						res.invalid = true;
+						return res;
+					}
+					const uint8_t addr =
+					    (imm == Soft323xTrace::IMM_EXT)
+					        ? *p++
+					        : uint8_t(next_addr + ((imm >> 1U) ^ -(imm & 1U)));
+					const uint8_t value = *p++;
+					if ((tag & 0x07U) == Soft323xTrace::EV_WRITE) {
+						rtc.i2c_write(addr, value);
+					}
+					else if (rtc.i2c_read(addr) != value) {
+						if (res.mismatches++ == 0) {
+							res.first_mismatch = ev - m_data;
+						}
+					}
+					rtc.i2c_next_addr(addr);
+					next_addr = uint8_t(addr + 1U);
+					break;
+				}
+				default:
+					res.invalid = true;
+					return res;
+			}
+		}
+		return res;
+	}
+};
+
+#endif /* SOFT323X_TRACE_HPP */
@@ -17,8 +17,10 @@
  */
 
 #include <soft323x/soft323x.hpp>
+#include <soft323x/soft323x_probe.hpp>
 
 #include <iostream>
+#include <string>
 #include <foxen/unittest.h>
 
 /******************************************************************************
@@ -84,6 +86,70 @@ void test_number_of_days()
 	EXPECT_EQ(0, Soft323x<>::number_of_days(13, 20, 1));
 }
 
+/**
+ * Checks the number of days in the current month, which is cached by the
+ * RTC, against the registers.
+ */
+static void check_month_days(const Soft323x<> &t)
+{
+	EXPECT_EQ(Soft323x<>::number_of_days(t.month(), t.century(), t.year()),
+	          t.month_days());
+}
+
+void test_calendar_cache()
+{
+	// Visit the last second of each month from 1900 to 2699, once by writing
+	// the registers and once using set_epoch(), and tick into the next month
+	Soft323x<> t;
+	int64_t epoch = -2208988800LL;  // 1900/01/01
+	for (unsigned int y = 1900; y <= 2699; y++) {
+		const uint8_t c = y / 100, yy = y % 100;
+		for (uint8_t m = 1; m <= 12; m++) {
+			const uint8_t n = Soft323x<>::number_of_days(m, c, yy);
+			const uint8_t next_m = (m == 12) ? 1 : (m + 1);
+			const uint8_t next_yy = (m == 12) ? ((yy + 1) % 100) : yy;
+			epoch += n * 86400LL;
+
+			// The date is clamped to the number of days in the month
+			t.i2c_write(t.REG_SECONDS, t.bcd_enc(59));
+			t.i2c_write(t.REG_MINUTES, t.bcd_enc(59));
+			t.i2c_write(t.REG_HOURS, t.bcd_enc(23));
+			t.i2c_write(t.REG_DATE, t.bcd_enc(31));
+			t.i2c_write(t.REG_MONTH,
+			            t.bcd_enc(m) |
+			                (((c - 19) & 1) ? t.BIT_MONTH_CENTURY0 : 0) |
+			                (((c - 19) & 2) ? t.BIT_MONTH_CENTURY1 : 0) |
+			                (((c - 19) & 4) ? t.BIT_MONTH_CENTURY2 : 0));
+			t.i2c_write(t.REG_YEAR, t.bcd_enc(yy));
+			t.update();
+			ASSERT_EQ(n, t.date());
+			check_month_days(t);
+			ASSERT_EQ(epoch - 1, t.epoch());
+			t.tick();
+			t.update();
+			ASSERT_EQ(1, t.date());
+			ASSERT_EQ(next_m, t.month());
+			ASSERT_EQ(next_yy, t.year());
+			check_month_days(t);
+
+			ASSERT_TRUE(t.set_epoch(epoch - 1));
+			check_month_days(t);
+			t.tick();
+			t.update();
+			ASSERT_EQ(1, t.date());
+			ASSERT_EQ(next_m, t.month());
+			check_month_days(t);
+			if (y < 2699 || m < 12) {
+				ASSERT_EQ(epoch, t.epoch());
+			}
+		}
+	}
+
+	// After the last month, the century wraps around to 1900
+	EXPECT_EQ(19, t.century());
+	check_month_days(t);
+}
+
 void test_update_24_hours()
 {
 	Soft323x<> soft323x;  // Initialises to Tuesday, 2019/01/01 00:00
@@ -802,11 +868,956 @@ void test_write_alarm_2_date_match()
 	ASSERT_EQ(0, t.i2c_read(t.REG_CTRL_2));
 }
 
+void test_alarm_cache()
+{
+	Soft323x<> t;
+	EXPECT_EQ(0, t.i2c_write(t.REG_CTRL_2, 0x00));
+
+	// Alarm 1 at mm:ss == 05:10, Alarm 2 at mm == 06 of every hour
+	EXPECT_EQ(0, t.i2c_write(t.REG_ALARM_1_SECONDS, t.bcd_enc(10)));
+	EXPECT_EQ(0, t.i2c_write(t.REG_ALARM_1_MINUTES, t.bcd_enc(5)));
+	EXPECT_EQ(0, t.i2c_write(t.REG_ALARM_1_HOURS, t.BIT_ALARM_MODE));
+	EXPECT_EQ(0, t.i2c_write(t.REG_ALARM_1_DAY_OR_DATE, t.BIT_ALARM_MODE));
+	EXPECT_EQ(0, t.i2c_write(t.REG_ALARM_2_MINUTES, t.bcd_enc(6)));
+	EXPECT_EQ(0, t.i2c_write(t.REG_ALARM_2_HOURS, t.BIT_ALARM_MODE));
+	EXPECT_EQ(0, t.i2c_write(t.REG_ALARM_2_DAY_OR_DATE, t.BIT_ALARM_MODE));
+	for (int i = 0; i < 5 * 60 + 5; i++) {
+		t.tick();
+		t.update();
+	}
+	EXPECT_EQ(5, t.minutes());
+	EXPECT_EQ(0, t.i2c_read(t.REG_CTRL_2));
+
+	// Changing the minutes of the alarm within the minute is not masked by
+	// the comparison cached at the last minute change
+	EXPECT_EQ(0, t.i2c_write(t.REG_ALARM_1_MINUTES, t.bcd_enc(6)));
+	for (int i = 0; i < 10; i++) {
+		t.tick();
+		t.update();
+	}
+	EXPECT_EQ(0, t.i2c_read(t.REG_CTRL_2));
+
+	// Writing the minutes of the time takes effect as well
+	EXPECT_EQ(0, t.i2c_write(t.REG_MINUTES, t.bcd_enc(6)));
+	EXPECT_EQ(t.ACTION_RESET_TIMER, t.i2c_write(t.REG_SECONDS, t.bcd_enc(8)));
+	t.tick();
+	t.update();
+	EXPECT_EQ(0, t.i2c_read(t.REG_CTRL_2));
+	t.tick();
+	t.update();
+	EXPECT_EQ(t.BIT_CTRL_2_A1F, t.i2c_read(t.REG_CTRL_2));
+
+	// Alarm 2 only matches at the full minute
+	EXPECT_EQ(0, t.i2c_write(t.REG_CTRL_2, 0x00));
+	EXPECT_EQ(0, t.i2c_write(t.REG_MINUTES, t.bcd_enc(5)));
+	EXPECT_EQ(t.ACTION_RESET_TIMER, t.i2c_write(t.REG_SECONDS, t.bcd_enc(58)));
+	t.tick();
+	t.update();
+	EXPECT_EQ(0, t.i2c_read(t.REG_CTRL_2));
+	t.tick();
+	t.update();
+	EXPECT_EQ(t.BIT_CTRL_2_A2F, t.i2c_read(t.REG_CTRL_2));
+
+	// Setting the time recomputes all comparisons
+	EXPECT_EQ(0, t.i2c_write(t.REG_CTRL_2, 0x00));
+	EXPECT_TRUE(t.set_epoch(1560000000 - 1560000000 % 3600 + 6 * 60 + 9));
+	t.tick();
+	t.update();
+	EXPECT_EQ(t.BIT_CTRL_2_A1F, t.i2c_read(t.REG_CTRL_2));
+}
+
+void test_epoch()
+{
+	Soft323x<> t;  // Initialises to Tuesday, 2019/01/01 00:00
+	EXPECT_TRUE(t.epoch() == 1546300800LL);
+
+	// Compare against a per-second count over several years, including the
+	// leap year 2020
+	int64_t expected = t.epoch();
+	for (int i = 0; i < 3 * 366 * 24; i++) {
+		ASSERT_TRUE(t.epoch() == expected);
+		for (int j = 0; j < 3600; j += 200) {
+			for (int k = 0; k < 200; k++) {
+				t.tick();
+			}
+			t.update();
+		}
+		expected += 3600;
+	}
+}
+
+void test_set_epoch()
+{
+	Soft323x<> t;
+
+	// Thursday, 1970/01/01 00:00:00
+	EXPECT_TRUE(t.set_epoch(0));
+	EXPECT_EQ(19, t.century());
+	EXPECT_EQ(70, t.year());
+	EXPECT_EQ(1, t.month());
+	EXPECT_EQ(1, t.date());
+	EXPECT_EQ(4, t.day());
+	EXPECT_EQ(0, t.hours());
+
+	// Tuesday, 2000/02/29 13:37:42
+	EXPECT_TRUE(t.set_epoch(951831462LL));
+	EXPECT_EQ(20, t.century());
+	EXPECT_EQ(0, t.year());
+	EXPECT_EQ(2, t.month());
+	EXPECT_EQ(29, t.date());
+	EXPECT_EQ(2, t.day());
+	EXPECT_EQ(13, t.hours());
+	EXPECT_EQ(37, t.minutes());
+	EXPECT_EQ(42, t.seconds());
+
+	// The 12 hour mode is preserved
+	t.i2c_write(t.REG_HOURS, t.bcd_enc(12) | t.BIT_HOUR_12_HOURS);
+	EXPECT_TRUE(t.set_epoch(951831462LL));
+	EXPECT_EQ(13, t.hours());
+	EXPECT_EQ(t.BIT_HOUR_12_HOURS | t.BIT_HOUR_PM | t.bcd_enc(1),
+	          t.i2c_read(t.REG_HOURS));
+
+	// Monday, 1900/01/01 00:00:00 and Sunday, 2699/12/31 23:59:59
+	EXPECT_TRUE(t.set_epoch(-t.EPOCH_1900));
+	EXPECT_EQ(19, t.century());
+	EXPECT_EQ(0, t.year());
+	EXPECT_EQ(1, t.day());
+	EXPECT_TRUE(t.epoch() == -t.EPOCH_1900);
+	EXPECT_TRUE(t.set_epoch(23036572799LL));
+	EXPECT_EQ(26, t.century());
+	EXPECT_EQ(99, t.year());
+	EXPECT_EQ(12, t.month());
+	EXPECT_EQ(31, t.date());
+	EXPECT_EQ(7, t.day());
+	EXPECT_EQ(59, t.seconds());
+
+	// Out of range
+	EXPECT_FALSE(t.set_epoch(23036572800LL));
+	EXPECT_FALSE(t.set_epoch(-t.EPOCH_1900 - 1));
+	EXPECT_TRUE(t.epoch() == 23036572799LL);
+
+	// Round trip
+	for (int64_t i = -t.EPOCH_1900; i < 23036572800LL; i += 86399LL * 17LL) {
+		ASSERT_TRUE(t.set_epoch(i));
+		ASSERT_TRUE(t.epoch() == i);
+	}
+}
+
+struct MailboxConfig : public Soft323xDefaultConfig {
+	static constexpr bool MAILBOX = true;
+};
+
+void test_mailbox()
+{
+	Soft323x<16, MailboxConfig> t;
+
+	// Set the time to 2000/02/29 13:37:42
+	const uint64_t epoch = 951831462ULL;
+	for (int i = 0; i < 8; i++) {
+		EXPECT_EQ(0, t.i2c_write(t.REG_MAILBOX + i, uint8_t(epoch >> (8 * i))));
+	}
+	EXPECT_EQ(uint8_t(epoch), t.i2c_read(t.REG_MAILBOX));
+	t.tick();
+	EXPECT_EQ(t.ACTION_RESET_TIMER,
+	          t.i2c_write(t.REG_MAILBOX_COMMAND, t.MAILBOX_CMD_SET_EPOCH));
+	EXPECT_EQ(t.CMD_STATUS_DONE, t.i2c_read(t.REG_MAILBOX_COMMAND));
+	t.update();  // Ticks were discarded
+	EXPECT_TRUE(t.epoch() == int64_t(epoch));
+
+	// Write a packed register image, the date is canonicalised right away
+	const uint8_t image[7] = {0x59, 0x59, 0x23, 0x03, 0x31, 0x82, 0x01};
+	for (int i = 0; i < 7; i++) {
+		EXPECT_EQ(0, t.i2c_write(t.REG_MAILBOX + i, image[i]));
+	}
+	EXPECT_EQ(t.ACTION_RESET_TIMER,
+	          t.i2c_write(t.REG_MAILBOX_COMMAND, t.MAILBOX_CMD_SET_TIME));
+	EXPECT_EQ(t.CMD_STATUS_DONE, t.i2c_read(t.REG_MAILBOX_COMMAND));
+	EXPECT_EQ(20, t.century());
+	EXPECT_EQ(1, t.year());
+	EXPECT_EQ(2, t.month());
+	EXPECT_EQ(28, t.date());
+	EXPECT_EQ(23, t.hours());
+
+	// Invalid commands and out-of-range time stamps are rejected
+	EXPECT_EQ(0, t.i2c_write(t.REG_MAILBOX_COMMAND, 0x42));
+	EXPECT_EQ(t.CMD_STATUS_ERROR, t.i2c_read(t.REG_MAILBOX_COMMAND));
+	for (int i = 0; i < 8; i++) {
+		EXPECT_EQ(0, t.i2c_write(t.REG_MAILBOX + i, 0x7F));
+	}
+	EXPECT_EQ(0, t.i2c_write(t.REG_MAILBOX_COMMAND, t.MAILBOX_CMD_SET_EPOCH));
+	EXPECT_EQ(t.CMD_STATUS_ERROR, t.i2c_read(t.REG_MAILBOX_COMMAND));
+	EXPECT_EQ(28, t.date());
+
+	// The address only wraps after FFh, the gap reads as zero
+	EXPECT_EQ(t.REG_SRAM + 16, t.i2c_next_addr(t.REG_SRAM + 15));
+	EXPECT_EQ(0, t.i2c_read(t.REG_SRAM + 16));
+	EXPECT_EQ(t.REG_MAILBOX + 1, t.i2c_next_addr(t.REG_MAILBOX));
+	EXPECT_EQ(0, t.i2c_next_addr(0xFF));
+}
+
+void test_pec()
+{
+	// Check value of the CRC-8/SMBUS
+	uint8_t pec = 0;
+	for (const char *c = "123456789"; *c; c++) {
+		pec = Soft323x<>::pec_update(pec, *c);
+	}
+	EXPECT_EQ(0xF4, pec);
+
+	// Compare against a bitwise implementation
+	for (int i = 0; i < 256; i++) {
+		for (int j = 0; j < 256; j++) {
+			uint8_t ref = i ^ j;
+			for (int k = 0; k < 8; k++) {
+				ref = (ref & 0x80) ? ((ref << 1) ^ 0x07) : (ref << 1);
+			}
+			ASSERT_EQ(ref, Soft323x<>::pec_update(i, j));
+		}
+	}
+
+	// Feeding the PEC itself results in zero
+	EXPECT_EQ(0, Soft323x<>::pec_update(pec, pec));
+
+	// Register blocks
+	EXPECT_FALSE(Soft323x<>::i2c_block_end(Soft323x<>::REG_SECONDS));
+	EXPECT_TRUE(Soft323x<>::i2c_block_end(Soft323x<>::REG_YEAR));
+	EXPECT_TRUE(Soft323x<>::i2c_block_end(Soft323x<>::REG_CTRL_3));
+	EXPECT_TRUE(Soft323x<16>::i2c_block_end(Soft323x<>::REG_SRAM + 15));
+}
+
+struct AlarmTableConfig : public Soft323xDefaultConfig {
+	static constexpr uint8_t ALARM_TABLE_SIZE = 32;
+};
+
+template <typename T>
+static uint8_t alarm_table_insert(T &t, uint32_t time, uint8_t tag)
+{
+	for (int i = 0; i < 4; i++) {
+		t.i2c_write(t.REG_ALARM_TABLE + i, uint8_t(time >> (8 * i)));
+	}
+	t.i2c_write(t.REG_ALARM_TABLE_TAG, tag);
+	t.i2c_write(t.REG_ALARM_TABLE_COMMAND, t.ALARM_TABLE_CMD_INSERT);
+	return t.i2c_read(t.REG_ALARM_TABLE_COMMAND);
+}
+
+template <typename T>
+static uint32_t alarm_table_time(T &t)
+{
+	uint32_t time = 0;
+	for (int i = 3; i >= 0; i--) {
+		time = (time << 8) | t.i2c_read(t.REG_ALARM_TABLE + i);
+	}
+	return time;
+}
+
+void test_alarm_table()
+{
+	Soft323x<16, AlarmTableConfig> t;
+	const uint32_t now = 1546300800UL;  // 2019/01/01 00:00:00
+
+	// Fill the table in pseudo-random order
+	EXPECT_EQ(0, t.i2c_read(t.REG_ALARM_TABLE_COUNT));
+	for (int i = 0; i < 32; i++) {
+		const uint32_t dt = ((i * 7) % 32) * 10 + 10;
+		EXPECT_EQ(t.CMD_STATUS_DONE, alarm_table_insert(t, now + dt, i));
+	}
+	EXPECT_EQ(32, t.i2c_read(t.REG_ALARM_TABLE_COUNT));
+	EXPECT_EQ(t.CMD_STATUS_ERROR, alarm_table_insert(t, now, 0));
+
+	// Peek at the head
+	t.i2c_write(t.REG_ALARM_TABLE_COMMAND, t.ALARM_TABLE_CMD_PEEK);
+	EXPECT_EQ(t.CMD_STATUS_DONE, t.i2c_read(t.REG_ALARM_TABLE_COMMAND));
+	EXPECT_TRUE(alarm_table_time(t) == now + 10);
+	EXPECT_EQ(0, t.i2c_read(t.REG_ALARM_TABLE_TAG));
+
+	// Enable the interrupt
+	t.i2c_write(t.REG_ALARM_TABLE_STATUS, 0xFF);
+	EXPECT_EQ(t.BIT_ALARM_TABLE_ATIE, t.i2c_read(t.REG_ALARM_TABLE_STATUS));
+	EXPECT_FALSE(t.interrupt());
+
+	// Every ten seconds an entry expires; pop it and check the order
+	for (int i = 0; i < 32; i++) {
+		for (int j = 0; j < 10; j++) {
+			EXPECT_FALSE(t.interrupt());
+			t.tick();
+			t.update();
+		}
+		ASSERT_TRUE(t.interrupt());
+		ASSERT_EQ(t.BIT_ALARM_TABLE_ATF | t.BIT_ALARM_TABLE_ATIE,
+		          t.i2c_read(t.REG_ALARM_TABLE_STATUS));
+		t.i2c_write(t.REG_ALARM_TABLE_COMMAND, t.ALARM_TABLE_CMD_POP);
+		ASSERT_EQ(t.CMD_STATUS_DONE, t.i2c_read(t.REG_ALARM_TABLE_COMMAND));
+		ASSERT_TRUE(alarm_table_time(t) == now + 10 * (i + 1));
+		ASSERT_EQ((i * 23) % 32, t.i2c_read(t.REG_ALARM_TABLE_TAG));
+		ASSERT_EQ(t.BIT_ALARM_TABLE_ATIE, t.i2c_read(t.REG_ALARM_TABLE_STATUS));
+	}
+	EXPECT_EQ(0, t.i2c_read(t.REG_ALARM_TABLE_COUNT));
+	t.i2c_write(t.REG_ALARM_TABLE_COMMAND, t.ALARM_TABLE_CMD_POP);
+	EXPECT_EQ(t.CMD_STATUS_ERROR, t.i2c_read(t.REG_ALARM_TABLE_COMMAND));
+
+	// Entries in the past expire right away; writing the time is respected
+	EXPECT_EQ(t.CMD_STATUS_DONE, alarm_table_insert(t, now + 1000, 1));
+	t.update();
+	EXPECT_FALSE(t.interrupt());
+	t.i2c_write(t.REG_MINUTES, t.bcd_enc(20));
+	t.update();
+	EXPECT_TRUE(t.interrupt());
+	t.i2c_write(t.REG_ALARM_TABLE_COMMAND, t.ALARM_TABLE_CMD_CLEAR);
+	EXPECT_EQ(0, t.i2c_read(t.REG_ALARM_TABLE_COUNT));
+	EXPECT_FALSE(t.interrupt());
+}
+
+void test_interrupt()
+{
+	Soft323x<> t;
+
+	// Alarm 1 every second, interrupts disabled
+	t.i2c_write(t.REG_CTRL_2, 0x00);
+	t.i2c_write(t.REG_ALARM_1_SECONDS, t.BIT_ALARM_MODE);
+	t.i2c_write(t.REG_ALARM_1_MINUTES, t.BIT_ALARM_MODE);
+	t.i2c_write(t.REG_ALARM_1_HOURS, t.BIT_ALARM_MODE);
+	t.i2c_write(t.REG_ALARM_1_DAY_OR_DATE, t.BIT_ALARM_MODE);
+	t.tick();
+	t.update();
+	EXPECT_FALSE(t.interrupt());
+
+	// Enable the interrupt
+	t.i2c_write(t.REG_CTRL_1, t.BIT_CTRL_1_INTCN | t.BIT_CTRL_1_A1IE);
+	EXPECT_TRUE(t.interrupt());
+	t.i2c_write(t.REG_CTRL_2, 0x00);
+	EXPECT_FALSE(t.interrupt());
+}
+
+struct CaptureConfig : public Soft323xDefaultConfig {
+	static constexpr uint8_t CAPTURE_FIFO_SIZE = 4;
+};
+
+void test_capture()
+{
+	Soft323x<16, CaptureConfig> t;
+	const uint32_t now = 1546300800UL;  // 2019/01/01 00:00:00
+
+	EXPECT_EQ(0, t.i2c_read(t.REG_CAPTURE_COUNT));
+	t.i2c_write(t.REG_CAPTURE_COMMAND, t.CAPTURE_CMD_POP);
+	EXPECT_EQ(t.CMD_STATUS_ERROR, t.i2c_read(t.REG_CAPTURE_COMMAND));
+
+	// Capture with committed and uncommitted ticks
+	t.capture(1234);
+	t.tick();
+	t.capture(5);
+	t.update();
+	t.tick();
+	t.tick();
+	t.capture(31249);
+	t.update();
+	t.capture(0);
+	EXPECT_EQ(4, t.i2c_read(t.REG_CAPTURE_COUNT));
+
+	// The FIFO overflows
+	t.capture(42);
+	EXPECT_EQ(4 | t.BIT_CAPTURE_OVF, t.i2c_read(t.REG_CAPTURE_COUNT));
+
+	// Read the events in order
+	const uint32_t times[4] = {now, now + 1, now + 3, now + 3};
+	const uint16_t counts[4] = {1234, 5, 31249, 0};
+	for (int i = 0; i < 4; i++) {
+		t.i2c_write(t.REG_CAPTURE_COMMAND, t.CAPTURE_CMD_POP);
+		EXPECT_EQ(t.CMD_STATUS_DONE, t.i2c_read(t.REG_CAPTURE_COMMAND));
+		uint32_t time = 0;
+		for (int j = 3; j >= 0; j--) {
+			time = (time << 8) | t.i2c_read(t.REG_CAPTURE + j);
+		}
+		EXPECT_TRUE(time == times[i]);
+		EXPECT_EQ(counts[i], t.i2c_read(t.REG_CAPTURE + 4) |
+		                         (t.i2c_read(t.REG_CAPTURE + 5) << 8));
+	}
+	EXPECT_EQ(t.BIT_CAPTURE_OVF, t.i2c_read(t.REG_CAPTURE_COUNT));
+
+	// Clear the overflow flag
+	t.i2c_write(t.REG_CAPTURE_COMMAND, t.CAPTURE_CMD_CLEAR);
+	EXPECT_EQ(0, t.i2c_read(t.REG_CAPTURE_COUNT));
+
+	// Captures follow writes to the time registers after the next update
+	t.i2c_write(t.REG_YEAR, t.bcd_enc(20));
+	t.update();
+	t.capture(0);
+	t.i2c_write(t.REG_CAPTURE_COMMAND, t.CAPTURE_CMD_POP);
+	EXPECT_EQ(0x5E, t.i2c_read(t.REG_CAPTURE + 3));  // 2020/01/01 = 5E0BE100h
+
+	// An event between a write to the seconds register and the next update
+	// receives the new time; it cannot be popped before the update
+	t.i2c_write(t.REG_CAPTURE_COMMAND, t.CAPTURE_CMD_CLEAR);
+	t.tick();
+	t.i2c_write(t.REG_SECONDS, t.bcd_enc(30));
+	t.capture(7);
+	t.i2c_write(t.REG_CAPTURE_COMMAND, t.CAPTURE_CMD_POP);
+	EXPECT_EQ(t.CMD_STATUS_ERROR, t.i2c_read(t.REG_CAPTURE_COMMAND));
+	t.update();
+	t.i2c_write(t.REG_CAPTURE_COMMAND, t.CAPTURE_CMD_POP);
+	EXPECT_EQ(t.CMD_STATUS_DONE, t.i2c_read(t.REG_CAPTURE_COMMAND));
+	EXPECT_EQ(0x1E, t.i2c_read(t.REG_CAPTURE));  // 5E0BE11Eh
+	EXPECT_EQ(7, t.i2c_read(t.REG_CAPTURE + 4));
+
+	// A write to the alarm 1 seconds register discards the pending ticks
+	// without advancing the cached time
+	t.i2c_write(t.REG_CAPTURE_COMMAND, t.CAPTURE_CMD_CLEAR);
+	t.tick();
+	t.i2c_write(t.REG_ALARM_1_SECONDS, 0x30);
+	t.update();
+	t.tick();
+	t.update();
+	t.capture(0);
+	t.i2c_write(t.REG_CAPTURE_COMMAND, t.CAPTURE_CMD_POP);
+	uint32_t time = 0;
+	for (int j = 3; j >= 0; j--) {
+		time = (time << 8) | t.i2c_read(t.REG_CAPTURE + j);
+	}
+	EXPECT_TRUE(int64_t(time) == t.epoch());
+}
+
+struct PPSConfig : public Soft323xDefaultConfig {
+	static constexpr uint16_t TICK_PERIOD = 32768;
+	static constexpr bool PPS = true;
+};
+
+void test_pps()
+{
+	// Simulate a local oscillator running 50ppm fast, i.e. 32769.6 counts per
+	// second. PPS edges arrive with an initial phase offset of 10000 counts.
+	Soft323x<0, PPSConfig> t;
+	uint64_t tick_count = t.next_tick_period(), tick_start = 0;
+	uint64_t pps_count = 10000;
+	uint32_t pps_idx = 0, n_ticks = 0;
+	uint64_t window_start = 0;
+	int32_t phase = 0;
+	bool pps_enabled = true;
+	while (n_ticks < 400) {
+		if (pps_enabled && pps_count < tick_count) {
+			phase = int32_t(pps_count - tick_start);
+			t.pps(uint16_t(phase));
+			t.update();
+			pps_idx++;
+			pps_count = 10000 + (uint64_t(pps_idx) * 327696U) / 10U;
+			continue;
+		}
+		t.tick();
+		tick_start = tick_count;
+		tick_count += t.next_tick_period();
+		t.update();
+		n_ticks++;
+		if (n_ticks == 200) {
+			// The loop is locked in frequency and phase
+			EXPECT_TRUE(t.pps_locked());
+			EXPECT_TRUE(phase < 2 || phase > 32767);
+			window_start = tick_start;
+		}
+		else if (n_ticks == 300) {
+			// The average period matches the oscillator within 1ppm
+			const uint64_t len = tick_start - window_start;
+			EXPECT_TRUE(len >= 3276956U && len <= 3276964U);
+			window_start = tick_start;
+			pps_enabled = false;
+		}
+		else if (n_ticks == 304) {
+			EXPECT_FALSE(t.pps_locked());
+		}
+	}
+
+	// Holdover keeps the last rate estimate
+	const uint64_t len = tick_start - window_start;
+	EXPECT_TRUE(len >= 3276956U && len <= 3276964U);
+
+	// Without rate control the nominal period is returned
+	Soft323x<> u;
+	EXPECT_EQ(0, u.next_tick_period());
+	EXPECT_FALSE(u.pps_locked());
+}
+
+struct TimerConfig : public Soft323xDefaultConfig {
+	static constexpr bool TIMER = true;
+};
+
+void test_timer()
+{
+	Soft323x<16, TimerConfig> t;
+	const uint8_t te_tie = t.BIT_TIMER_TE | t.BIT_TIMER_TIE;
+
+	// One-shot timer expiring after 300 seconds
+	t.i2c_write(t.REG_TIMER_RELOAD, 0x2C);
+	t.i2c_write(t.REG_TIMER_RELOAD + 1, 0x01);
+	t.i2c_write(t.REG_TIMER, te_tie);
+	EXPECT_EQ(0x2C, t.i2c_read(t.REG_TIMER_COUNT));
+	EXPECT_EQ(0x01, t.i2c_read(t.REG_TIMER_COUNT + 1));
+	for (int i = 0; i < 299; i++) {
+		t.tick();
+		t.update();
+	}
+	EXPECT_EQ(1, t.i2c_read(t.REG_TIMER_COUNT));
+	EXPECT_FALSE(t.interrupt());
+	t.tick();
+	t.update();
+	EXPECT_TRUE(t.interrupt());
+	EXPECT_EQ(t.BIT_TIMER_TIE | t.BIT_TIMER_TF, t.i2c_read(t.REG_TIMER));
+
+	// TF can only be cleared; the timer stays stopped
+	t.i2c_write(t.REG_TIMER, t.BIT_TIMER_TIE | t.BIT_TIMER_TF);
+	EXPECT_TRUE(t.interrupt());
+	t.i2c_write(t.REG_TIMER, t.BIT_TIMER_TIE);
+	EXPECT_FALSE(t.interrupt());
+	for (int i = 0; i < 400; i++) {
+		t.tick();
+		t.update();
+	}
+	EXPECT_FALSE(t.interrupt());
+
+	// Periodic timer with a period of 7 seconds, updated in batches of ten
+	// ticks; the counter must stay in phase
+	t.i2c_write(t.REG_TIMER_RELOAD, 7);
+	t.i2c_write(t.REG_TIMER_RELOAD + 1, 0);
+	t.i2c_write(t.REG_TIMER, te_tie | t.BIT_TIMER_TP);
+	for (int i = 1; i <= 70; i++) {
+		for (int j = 0; j < 10; j++) {
+			t.tick();
+		}
+		t.update();
+		EXPECT_EQ(7 - (i * 10) % 7, t.i2c_read(t.REG_TIMER_COUNT));
+		EXPECT_TRUE(t.interrupt());
+		t.i2c_write(t.REG_TIMER, te_tie | t.BIT_TIMER_TP);
+		EXPECT_FALSE(t.interrupt());
+	}
+
+	// Writing the reload value does not restart a running timer
+	t.i2c_write(t.REG_TIMER_RELOAD, 100);
+	EXPECT_EQ(7, t.i2c_read(t.REG_TIMER_COUNT));
+	t.advance(7);
+	EXPECT_TRUE(t.interrupt());
+	EXPECT_EQ(100, t.i2c_read(t.REG_TIMER_COUNT));
+	t.advance(250);
+	EXPECT_EQ(50, t.i2c_read(t.REG_TIMER_COUNT));
+
+	// Stopping the timer
+	t.i2c_write(t.REG_TIMER, 0x00);
+	t.advance(1000);
+	EXPECT_EQ(0, t.i2c_read(t.REG_TIMER));
+	EXPECT_EQ(50, t.i2c_read(t.REG_TIMER_COUNT));
+	EXPECT_FALSE(t.interrupt());
+}
+
+void test_advance()
+{
+	// Compare advance() against ticking every second for random alarm
+	// configurations, chunk sizes and start times
+	uint32_t state = 12345;
+	auto rnd = [&state]() {
+		state = state * 1103515245U + 12345U;
+		return (state >> 8) & 0xFFFF;
+	};
+	for (int cfg = 0; cfg < 40; cfg++) {
+		Soft323x<> a, b;
+		uint8_t regs[14];
+		regs[0] = a.bcd_enc(rnd() % 60);
+		regs[1] = a.bcd_enc(rnd() % 60);
+		regs[2] = (cfg & 1) ? (0x40 | a.bcd_enc(1 + rnd() % 12) |
+		                       ((rnd() & 1) ? 0x20 : 0x00))
+		                    : a.bcd_enc(rnd() % 24);
+		regs[3] = 1 + rnd() % 7;
+		regs[4] = a.bcd_enc(1 + rnd() % 28);
+		regs[5] = a.bcd_enc(1 + rnd() % 12);
+		regs[6] = a.bcd_enc(rnd() % 100);
+
+		// Alarm 1 and 2 with random masks; keep the match values small so
+		// the alarms actually fire
+		regs[7] = a.bcd_enc(rnd() % 60) | ((rnd() % 3 == 0) ? 0x80 : 0x00);
+		regs[8] = a.bcd_enc(rnd() % 60) | ((rnd() % 2 == 0) ? 0x80 : 0x00);
+		regs[9] = a.bcd_enc(rnd() % 24) | ((rnd() % 3 != 0) ? 0x80 : 0x00);
+		regs[10] = ((rnd() & 1) ? (0x40 | (1 + rnd() % 7))
+		                        : a.bcd_enc(1 + rnd() % 28)) |
+		           ((rnd() % 4 != 0) ? 0x80 : 0x00);
+		regs[11] = a.bcd_enc(rnd() % 60) | ((rnd() % 2 == 0) ? 0x80 : 0x00);
+		regs[12] = a.bcd_enc(rnd() % 24) | ((rnd() % 3 != 0) ? 0x80 : 0x00);
+		regs[13] = a.bcd_enc(1 + rnd() % 28) | ((rnd() % 4 != 0) ? 0x80 : 0x00);
+		for (uint8_t i = 0; i < 14; i++) {
+			a.i2c_write(i, regs[i]);
+			b.i2c_write(i, regs[i]);
+		}
+		a.update();
+		b.update();
+
+		for (int chunk = 0; chunk < 40; chunk++) {
+			const uint32_t n = (chunk % 4 == 0) ? (rnd() % 50000)
+			                                    : (rnd() % 300);
+			a.advance(n);
+			for (uint32_t i = 0; i < n; i++) {
+				b.tick();
+				if (i % 200 == 199 || i + 1 == n) {
+					b.update();
+				}
+			}
+			for (uint8_t i = 0; i < 0x14; i++) {
+				EXPECT_EQ(b.i2c_read(i), a.i2c_read(i));
+			}
+
+			// Clear the alarm flags every now and then
+			if (rnd() & 1) {
+				a.i2c_write(0x0F, 0x00);
+				b.i2c_write(0x0F, 0x00);
+			}
+		}
+	}
+}
+
+struct DriftConfig : public Soft323xDefaultConfig {
+	static constexpr uint16_t TICK_PERIOD = 32768;
+	static constexpr bool DRIFT_ESTIMATOR = true;
+};
+
+/**
+ * Sets the time the way a host does, i.e. by writing the time registers,
+ * and reports the timer phase to the drift estimator.
+ */
+static void drift_set_time(Soft323x<0, DriftConfig> &t, int64_t epoch,
+                           uint16_t phase)
+{
+	Soft323x<> s;
+	s.set_epoch(epoch);
+	for (uint8_t i = s.REG_SECONDS; i <= s.REG_YEAR; i++) {
+		t.i2c_write(i, s.i2c_read(i));
+	}
+	t.time_set_phase(phase);
+	t.update();
+}
+
+void test_drift()
+{
+	// Simulate a local oscillator running 50ppm fast, i.e. 32769.6 counts per
+	// second. The host sets the correct time every 1000 seconds.
+	Soft323x<0, DriftConfig> t;
+	const int64_t epoch0 = 1560000000;
+	uint64_t tick_start = 0, tick_count = t.next_tick_period();
+	int64_t err = 0;
+	for (uint32_t i = 0; i <= 12; i++) {
+		const uint64_t target = uint64_t(i) * 1000U * 327696U / 10U;
+		while (tick_count <= target) {
+			t.tick();
+			tick_start = tick_count;
+			tick_count += t.next_tick_period();
+			t.update();
+		}
+
+		// Error of the clock in timer counts at the time of the time set
+		const uint64_t phase = target - tick_start;
+		err = (t.epoch() - epoch0 - i * 1000) * 32768 + int64_t(phase);
+		if (i == 1) {
+			EXPECT_TRUE(err >= 1600 && err <= 1680);
+		}
+		drift_set_time(t, epoch0 + i * 1000, uint16_t(phase));
+		tick_count = target + (tick_count - tick_start);
+		tick_start = target;
+	}
+
+	// The clock is corrected to within 1ms per 1000s
+	EXPECT_TRUE(err > -33 && err < 33);
+	const uint32_t period = t.tick_period();
+	EXPECT_TRUE(period > 2147588505U - 4096U && period < 2147588505U + 4096U);
+
+	// Deliberate time changes and short intervals do not affect the estimate
+	t.advance(1000);
+	drift_set_time(t, epoch0 + 3600, 0);
+	EXPECT_EQ(period, t.tick_period());
+	t.advance(100);
+	drift_set_time(t, epoch0, 0);
+	EXPECT_EQ(period, t.tick_period());
+
+	// Long intervals are scaled down: 20ppm slow over 4000000 seconds
+	Soft323x<0, DriftConfig> v;
+	drift_set_time(v, epoch0, 0);
+	const uint32_t nominal = v.tick_period();
+	v.advance(4000000);
+	drift_set_time(v, epoch0 + 4000080, 0);
+	const int32_t delta = int32_t(v.tick_period() - nominal);
+	EXPECT_TRUE(delta > -21475 - 64 && delta < -21475 + 64);
+
+	// Without rate control the nominal period is returned
+	Soft323x<> u;
+	EXPECT_EQ(0U, u.tick_period());
+}
+
+struct SubsecondConfig : public Soft323xDefaultConfig {
+	static constexpr bool MAILBOX = true;
+	static constexpr uint16_t TICK_PERIOD = 32768;
+	static constexpr bool DRIFT_ESTIMATOR = true;
+	static constexpr bool SUBSECOND = true;
+};
+
+/**
+ * Arms the sub-second offset and sets the time in a single burst of the
+ * time registers.
+ */
+static uint8_t subsecond_set_time(Soft323x<0, SubsecondConfig> &t,
+                                  int64_t epoch, uint16_t offset)
+{
+	Soft323x<> s;
+	s.set_epoch(epoch);
+	t.i2c_write(t.REG_SUBSECOND, uint8_t(offset));
+	t.i2c_write(t.REG_SUBSECOND + 1, uint8_t(offset >> 8));
+	uint8_t res = 0;
+	for (uint8_t i = s.REG_SECONDS; i <= s.REG_YEAR; i++) {
+		res |= t.i2c_write(i, s.i2c_read(i));
+	}
+	return res;
+}
+
+void test_subsecond()
+{
+	using RTC = Soft323x<0, SubsecondConfig>;
+	RTC t;
+	EXPECT_EQ(0xD6U, RTC::REG_EXT_BEGIN);
+	EXPECT_TRUE(RTC::i2c_block_end(RTC::REG_SUBSECOND + 1));
+	EXPECT_EQ(0U, t.timer_preload());
+
+	// The armed offset is converted to timer counts when the seconds are
+	// written
+	EXPECT_EQ(t.ACTION_RESET_TIMER, subsecond_set_time(t, 1560000000, 0x4000));
+	EXPECT_EQ(8192U, t.timer_preload());
+	EXPECT_EQ(0x00, t.i2c_read(t.REG_SUBSECOND));
+	EXPECT_EQ(0x40, t.i2c_read(t.REG_SUBSECOND + 1));
+	t.time_set_phase(0);
+	t.update();
+	EXPECT_EQ(1560000000, t.epoch());
+
+	// The offset only applies once
+	t.i2c_write(t.REG_SECONDS, 0x30);
+	EXPECT_EQ(0U, t.timer_preload());
+	t.update();
+
+	// Writing the LSB alone does not arm the offset
+	t.i2c_write(t.REG_SUBSECOND, 0x12);
+	t.i2c_write(t.REG_SECONDS, 0x00);
+	EXPECT_EQ(0U, t.timer_preload());
+	t.update();
+
+	// The offset applies to the time set in the next write message, but is
+	// discarded at the end of that message if it did not set the time
+	t.i2c_write(t.REG_SUBSECOND, 0x00);
+	t.i2c_write(t.REG_SUBSECOND + 1, 0x40);
+	t.i2c_stop();
+	t.i2c_write(t.REG_SECONDS, 0x00);
+	t.i2c_stop();
+	EXPECT_EQ(8192U, t.timer_preload());
+	t.update();
+	t.i2c_write(t.REG_SUBSECOND + 1, 0x40);
+	t.i2c_stop();
+	t.i2c_write(t.REG_ALARM_1_SECONDS, 0x00);
+	t.i2c_stop();
+	t.i2c_write(t.REG_SECONDS, 0x00);
+	EXPECT_EQ(0U, t.timer_preload());
+	t.update();
+
+	// Setting the time through the mailbox applies the offset as well
+	const uint64_t epoch = 1560000000;
+	for (uint8_t i = 0; i < 8; i++) {
+		t.i2c_write(t.REG_MAILBOX + i, uint8_t(epoch >> (8 * i)));
+	}
+	t.i2c_write(t.REG_SUBSECOND, 0x00);
+	t.i2c_write(t.REG_SUBSECOND + 1, 0x80);
+	EXPECT_EQ(t.ACTION_RESET_TIMER,
+	          t.i2c_write(t.REG_MAILBOX_COMMAND, t.MAILBOX_CMD_SET_EPOCH));
+	EXPECT_EQ(16384U, t.timer_preload());
+	t.time_set_phase(0);
+	t.update();
+
+	// The drift estimator accounts for the preload: a clock that is exactly
+	// on time reaches the preloaded count again after 1000 seconds
+	subsecond_set_time(t, 1560000000, 0x4000);
+	t.time_set_phase(0);
+	t.update();
+	const uint32_t period = t.tick_period();
+	t.advance(1000);
+	subsecond_set_time(t, 1560001000, 0x4000);
+	t.time_set_phase(8192);
+	t.update();
+	EXPECT_EQ(period, t.tick_period());
+	EXPECT_EQ(1560001000, t.epoch());
+}
+
+template <typename T>
+struct TicksConfig : public Soft323xDefaultConfig {
+	using Ticks = T;
+	static constexpr uint8_t CAPTURE_FIFO_SIZE = 4;
+};
+
+template <typename T>
+static void check_tick_policy()
+{
+	Soft323x<0, TicksConfig<T>> t;
+	t.set_epoch(1560000000);
+	for (int i = 0; i < 3; i++) {
+		t.tick();
+	}
+	EXPECT_TRUE(t.update());
+	EXPECT_EQ(1560000003, t.epoch());
+	EXPECT_FALSE(t.update());
+
+	// The counter holds up to 255 ticks; captures include uncommitted ticks
+	for (int i = 0; i < 255; i++) {
+		t.tick();
+	}
+	t.capture(0);
+	EXPECT_TRUE(t.update());
+	EXPECT_EQ(1560000258, t.epoch());
+	t.i2c_write(t.REG_CAPTURE_COMMAND, t.CAPTURE_CMD_POP);
+	uint32_t time = 0;
+	for (uint8_t i = 0; i < 4; i++) {
+		time |= uint32_t(t.i2c_read(t.REG_CAPTURE + i)) << (8 * i);
+	}
+	EXPECT_EQ(1560000258U, time);
+}
+
+void test_tick_policies()
+{
+	check_tick_policy<Soft323xTicksStd>();
+	check_tick_policy<Soft323xTicksSwap>();
+}
+
+/**
+ * Probe policy recording the sequence of hooks as a string.
+ */
+struct LogProbe {
+	static std::string log;
+	static void begin(uint8_t path) { log += char('0' + path); }
+	static void end(uint8_t path) { log += char('a' + path); }
+};
+std::string LogProbe::log;
+
+/**
+ * Cycle counter advancing by ten cycles per read.
+ */
+struct FakeCycles {
+	static uint32_t t;
+	static uint32_t now() { return t += 10U; }
+};
+uint32_t FakeCycles::t = 0U;
+
+template <typename P>
+struct ProbeConfig : public Soft323xDefaultConfig {
+	static constexpr bool MAILBOX = true;
+	using Probe = P;
+};
+
+void test_probe()
+{
+	// Hooks are called on entry and exit of each path and nest
+	Soft323x<0, ProbeConfig<LogProbe>> t;
+	LogProbe::log.clear();
+	t.tick();
+	EXPECT_TRUE(LogProbe::log == "0a");
+	LogProbe::log.clear();
+	t.update();
+	EXPECT_TRUE(LogProbe::log == "12c3db");
+	LogProbe::log.clear();
+	t.i2c_read(t.REG_SECONDS);
+	t.i2c_write(t.REG_CTRL_1, 0x1C);
+	EXPECT_TRUE(LogProbe::log == "4e5f");
+
+	// The mailbox re-enters i2c_write()
+	LogProbe::log.clear();
+	t.i2c_write(t.REG_MAILBOX_COMMAND, t.MAILBOX_CMD_SET_TIME);
+	EXPECT_TRUE(LogProbe::log == "55f5f5f5f5f5f5ff");
+
+	// Only the outermost call of a path is measured
+	using Probe = Soft323xProbeCycles<FakeCycles>;
+	Soft323x<0, ProbeConfig<Probe>> u;
+	Probe::reset();
+	u.i2c_write(u.REG_MAILBOX_COMMAND, u.MAILBOX_CMD_SET_TIME);
+	EXPECT_EQ(1U, Probe::stat(Soft323xProbePath::I2C_WRITE).count);
+	EXPECT_EQ(10U, Probe::stat(Soft323xProbePath::I2C_WRITE).min);
+	for (int i = 0; i < 3; i++) {
+		u.tick();
+	}
+	u.update();
+	const auto &inc = Probe::stat(Soft323xProbePath::INCREMENT_TIME);
+	EXPECT_EQ(3U, inc.count);
+	EXPECT_EQ(10U, inc.min);
+	EXPECT_EQ(10U, inc.max);
+	EXPECT_EQ(30U, inc.sum);
+	EXPECT_EQ(3U, inc.hist[3]);
+	const auto &upd = Probe::stat(Soft323xProbePath::UPDATE);
+	EXPECT_EQ(1U, upd.count);
+	EXPECT_EQ(130U, upd.max);
+
+	// Percentiles are bounded by the histogram buckets and the maximum
+	EXPECT_EQ(10U, Probe::percentile(Soft323xProbePath::INCREMENT_TIME, 0.5));
+	Probe::reset();
+	Probe::record(Probe::s_state.stat[Soft323xProbePath::TICK], 100U);
+	Probe::record(Probe::s_state.stat[Soft323xProbePath::TICK], 1000U);
+	EXPECT_EQ(127U, Probe::percentile(Soft323xProbePath::TICK, 0.5));
+	EXPECT_EQ(1000U, Probe::percentile(Soft323xProbePath::TICK, 0.9));
+}
+
+static bool battery = false;
+static bool on_battery() { return battery; }
+
+struct PowerConfig : public Soft323xDefaultConfig {
+	using Power = Soft323xPowerCallback<on_battery>;
+};
+
+void test_power_state()
+{
+	Soft323x<0, PowerConfig> t;
+	battery = false;
+	t.i2c_write(t.REG_CTRL_2, 0x00);
+	const int64_t t0 = t.epoch();
+
+	// Supplied by the host, the control bits only select the outputs
+	const uint8_t mains = t.POWER_OSCILLATOR | t.POWER_INT_SQW | t.POWER_BUS;
+	EXPECT_EQ(mains, t.power_state());
+	t.i2c_write(t.REG_CTRL_1, 0x80);
+	t.i2c_write(t.REG_CTRL_2, 0x08);
+	EXPECT_EQ(mains | t.POWER_SQW | t.POWER_32KHZ, t.power_state());
+
+	// On battery, the outputs require BBSQW and BB32KHZ and the bus is off
+	battery = true;
+	t.i2c_write(t.REG_CTRL_1, 0x00);
+	EXPECT_EQ(t.POWER_OSCILLATOR, t.power_state());
+	t.i2c_write(t.REG_CTRL_1, 0x44);
+	EXPECT_EQ(t.POWER_OSCILLATOR | t.POWER_INT_SQW, t.power_state());
+	t.i2c_write(t.REG_CTRL_1, 0x40);
+	t.i2c_write(t.REG_CTRL_2, 0x48);
+	EXPECT_EQ(t.POWER_OSCILLATOR | t.POWER_INT_SQW | t.POWER_SQW |
+	              t.POWER_32KHZ,
+	          t.power_state());
+
+	// The clock keeps running on battery unless EOSC is set
+	t.tick();
+	EXPECT_TRUE(t.update());
+	EXPECT_EQ(0x01, t.i2c_read(t.REG_SECONDS));
+	EXPECT_EQ(0x48, t.i2c_read(t.REG_CTRL_2));
+
+	// With EOSC set, everything is off, the ticks are discarded and the
+	// time is marked as invalid
+	t.i2c_write(t.REG_CTRL_1, 0xC0);
+	EXPECT_EQ(0U, t.power_state());
+	t.tick();
+	t.tick();
+	EXPECT_FALSE(t.update());
+	EXPECT_EQ(0x01, t.i2c_read(t.REG_SECONDS));
+	EXPECT_EQ(0xC8, t.i2c_read(t.REG_CTRL_2));
+
+	// Back on mains, the oscillator runs again
+	battery = false;
+	EXPECT_EQ(mains | t.POWER_SQW | t.POWER_32KHZ, t.power_state());
+	t.tick();
+	EXPECT_TRUE(t.update());
+	EXPECT_EQ(0x02, t.i2c_read(t.REG_SECONDS));
+	EXPECT_EQ(2, t.epoch() - t0);
+}
+
 int main()
 {
 	RUN(test_initialisation);
 	RUN(test_is_leap_year);
 	RUN(test_number_of_days);
+	RUN(test_calendar_cache);
 	RUN(test_update_24_hours);
 	RUN(test_update_12_hours);
 	RUN(test_write_seconds);
@@ -833,5 +1844,21 @@ int main()
 	RUN(test_write_alarm_2_hours_match);
 	RUN(test_write_alarm_2_day_match);
 	RUN(test_write_alarm_2_date_match);
+	RUN(test_alarm_cache);
+	RUN(test_epoch);
+	RUN(test_set_epoch);
+	RUN(test_mailbox);
+	RUN(test_pec);
+	RUN(test_alarm_table);
+	RUN(test_interrupt);
+	RUN(test_capture);
+	RUN(test_pps);
+	RUN(test_timer);
+	RUN(test_advance);
+	RUN(test_drift);
+	RUN(test_subsecond);
+	RUN(test_tick_policies);
+	RUN(test_probe);
+	RUN(test_power_state);
 	DONE;
 }
@@ -0,0 +1,260 @@
+/**
+ *  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Exhaustive verification of the alarm logic. Every combination of alarm
+ * mode bits is run with a representative target over the full four-year leap
+ * cycle 2024-2027, one tick at a time. After each second, the A1F and A2F
+ * flags are compared to an independent reference computed from the UNIX
+ * time. The work is split into quarter-year shards processed by one thread
+ * per core.
+ */
+
+#include <soft323x/soft323x.hpp>
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <foxen/unittest.h>
+
+using RTC = Soft323x<>;
+
+/**
+ * Decoded alarm setting. A field marked as "every" is ignored when matching,
+ * i.e. the corresponding AxMy bit is set.
+ */
+struct Alarm {
+	bool every_ss, every_mm, every_hh, every_date;
+	bool is_day;
+	uint8_t ss, mm, hh, date;  // hh is in 24-hour format
+};
+
+/**
+ * Alarm 1 and Alarm 2 settings simulated by one RTC instance.
+ */
+struct Case {
+	Alarm a1, a2;  // a2.every_ss and a2.ss are not used
+	bool hours_12;
+};
+
+static const Case CASES[] = {
+    // A1 once per second, A2 once per minute
+    {{true, true, true, true, false, 0, 0, 0, 1},
+     {true, true, true, true, false, 0, 0, 0, 1},
+     false},
+    // Seconds match, minutes match
+    {{false, true, true, true, false, 30, 0, 0, 1},
+     {true, false, true, true, false, 0, 30, 0, 1},
+     false},
+    // Minutes and seconds match, hours and minutes match
+    {{false, false, true, true, false, 59, 59, 0, 1},
+     {true, false, false, true, false, 0, 15, 6, 1},
+     false},
+    // Hours, minutes and seconds match, date match in 12-hour mode
+    {{false, false, false, true, false, 0, 0, 23, 1},
+     {true, false, false, false, false, 0, 59, 23, 31},
+     true},
+    // Date match on the leap day, day match on Mondays
+    {{false, false, false, false, false, 0, 0, 0, 29},
+     {true, false, false, false, true, 0, 0, 0, 1},
+     false},
+    // Day match on Sundays, date match at noon
+    {{false, false, false, false, true, 56, 34, 12, 7},
+     {true, false, false, false, false, 0, 0, 12, 29},
+     false},
+    // Midnight and noon in 12-hour mode
+    {{false, false, false, false, false, 0, 0, 12, 31},
+     {true, false, false, false, true, 0, 0, 0, 7},
+     true},
+};
+
+static constexpr size_t N_CASES = sizeof(CASES) / sizeof(CASES[0]);
+static constexpr int64_t CYCLE_START = 1704067200;  // 2024/01/01 00:00:00
+static constexpr int64_t CYCLE_END = 1830297600;    // 2028/01/01 00:00:00
+static constexpr size_t N_SHARDS = 16;
+
+/**
+ * Time fields of a UNIX time stamp, computed independently of Soft323x.
+ */
+struct Civil {
+	uint8_t ss, mm, hh, date, day;  // day is 1 for Monday
+};
+
+static Civil civil(int64_t t)
+{
+	// See http://howardhinnant.github.io/date_algorithms.html#civil_from_days
+	const int64_t days = t / 86400, rem = t % 86400;
+	const int64_t z = days + 719468;
+	const int64_t era = z / 146097;
+	const int64_t doe = z - era * 146097;
+	const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	const int64_t mp = (5 * doy + 2) / 153;
+
+	Civil c;
+	c.date = uint8_t(doy - (153 * mp + 2) / 5 + 1);
+	c.day = uint8_t((days + 3) % 7 + 1);  // 1970/01/01 was a Thursday
+	c.hh = uint8_t(rem / 3600);
+	c.mm = uint8_t(rem / 60 % 60);
+	c.ss = uint8_t(rem % 60);
+	return c;
+}
+
+static bool matches(const Alarm &a, const Civil &c, bool alarm_2)
+{
+	return (alarm_2 ? (c.ss == 0) : (a.every_ss || a.ss == c.ss)) &&
+	       (a.every_mm || a.mm == c.mm) && (a.every_hh || a.hh == c.hh) &&
+	       (a.every_date || a.date == (a.is_day ? c.day : c.date));
+}
+
+static uint8_t bcd(uint8_t v) { return uint8_t(((v / 10) << 4) | (v % 10)); }
+
+static uint8_t encode_hours(uint8_t hh, bool hours_12)
+{
+	if (!hours_12) {
+		return bcd(hh);
+	}
+	const uint8_t h = (hh % 12 == 0) ? 12 : (hh % 12);
+	return uint8_t(0x40 | ((hh >= 12) ? 0x20 : 0x00) | bcd(h));
+}
+
+static void write_alarm(RTC &rtc, uint8_t reg, const Alarm &a, bool alarm_2,
+                        bool hours_12)
+{
+	if (!alarm_2) {
+		rtc.i2c_write(reg++, (a.every_ss ? 0x80 : 0x00) | bcd(a.ss));
+	}
+	rtc.i2c_write(reg++, (a.every_mm ? 0x80 : 0x00) | bcd(a.mm));
+	rtc.i2c_write(reg++, (a.every_hh ? 0x80 : 0x00) |
+	                         encode_hours(a.hh, hours_12));
+	rtc.i2c_write(reg++, (a.every_date ? 0x80 : 0x00) |
+	                         (a.is_day ? 0x40 : 0x00) | bcd(a.date));
+}
+
+/**
+ * Result of a single shard.
+ */
+struct Result {
+	uint64_t checks = 0;
+	uint64_t fired[2] = {0, 0};
+	uint64_t errors = 0;
+	int64_t first_error = -1;
+};
+
+static Result run_shard(const Case &c, int64_t start, int64_t end)
+{
+	RTC rtc;
+	if (c.hours_12) {
+		rtc.i2c_write(RTC::REG_HOURS, 0x52);
+	}
+	rtc.set_epoch(start);
+	write_alarm(rtc, RTC::REG_ALARM_1_SECONDS, c.a1, false, c.hours_12);
+	write_alarm(rtc, RTC::REG_ALARM_2_MINUTES, c.a2, true, c.hours_12);
+	rtc.i2c_write(RTC::REG_CTRL_2, 0x00);
+	rtc.update();
+
+	Result res;
+	for (int64_t t = start + 1; t <= end; t++) {
+		rtc.tick();
+		rtc.update();
+
+		const Civil civ = civil(t);
+		const uint8_t expected = (matches(c.a1, civ, false) ? 0x01 : 0x00) |
+		                         (matches(c.a2, civ, true) ? 0x02 : 0x00);
+		const uint8_t flags = rtc.i2c_read(RTC::REG_CTRL_2) & 0x03;
+		if (flags != expected) {
+			if (res.errors++ == 0) {
+				res.first_error = t;
+			}
+		}
+		if (flags) {
+			res.fired[0] += flags & 0x01;
+			res.fired[1] += flags >> 1;
+			rtc.i2c_write(RTC::REG_CTRL_2, 0x00);
+		}
+		res.checks += 2;
+	}
+	return res;
+}
+
+/******************************************************************************
+ * MAIN                                                                       *
+ ******************************************************************************/
+
+void test_alarm_leap_cycle()
+{
+	// Split the cycle into shards and let each thread fetch the next shard
+	const size_t n_work = N_CASES * N_SHARDS;
+	std::vector<Result> results(n_work);
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		size_t i;
+		while ((i = next++) < n_work) {
+			const int64_t len = (CYCLE_END - CYCLE_START) / N_SHARDS;
+			const int64_t start = CYCLE_START + int64_t(i % N_SHARDS) * len;
+			const int64_t end =
+			    (i % N_SHARDS == N_SHARDS - 1) ? CYCLE_END : (start + len);
+			results[i] = run_shard(CASES[i / N_SHARDS], start, end);
+		}
+	};
+	const unsigned n_threads = std::max(1U, std::thread::hardware_concurrency());
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < n_threads; i++) {
+		threads.emplace_back(worker);
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+
+	uint64_t checks = 0;
+	for (size_t i = 0; i < N_CASES; i++) {
+		Result r;
+		for (size_t j = 0; j < N_SHARDS; j++) {
+			const Result &s = results[i * N_SHARDS + j];
+			r.checks += s.checks;
+			r.fired[0] += s.fired[0];
+			r.fired[1] += s.fired[1];
+			r.errors += s.errors;
+			if (r.first_error < 0) {
+				r.first_error = s.first_error;
+			}
+		}
+		checks += r.checks;
+		fprintf(stderr, "Case %zu: A1 fired %llu, A2 fired %llu times\n", i,
+		        (unsigned long long)r.fired[0],
+		        (unsigned long long)r.fired[1]);
+		if (r.errors) {
+			fprintf(stderr, "Case %zu: %llu mismatches, first at %lld\n", i,
+			        (unsigned long long)r.errors, (long long)r.first_error);
+		}
+		EXPECT_EQ(0U, r.errors);
+		EXPECT_TRUE(r.fired[0] > 0 && r.fired[1] > 0);
+	}
+	fprintf(stderr, "%llu alarm checks on %u threads\n",
+	        (unsigned long long)checks, n_threads);
+}
+
+int main()
+{
+	RUN(test_alarm_leap_cycle);
+	DONE;
+}
@@ -0,0 +1,106 @@
+/**
+ *  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <soft323x/soft323x_client.hpp>
+
+#include <foxen/unittest.h>
+
+using Bus = Soft323xEmulatedBus<>;
+using Client = Soft323xClient<Bus>;
+
+/**
+ * Virtual monotonic clock shared by the emulated device and the client.
+ */
+static uint64_t fake_now = 0;
+static uint64_t fake_clock() { return fake_now; }
+
+/******************************************************************************
+ * MAIN                                                                       *
+ ******************************************************************************/
+
+void test_client_extrapolation()
+{
+	fake_now = 1234567891ULL;
+	Bus bus(fake_clock);
+	const uint64_t origin = fake_now;
+	const int64_t epoch0 = bus.rtc().epoch();
+	fake_now += 300000000ULL;  // Start in the middle of a second
+
+	// Query the time every 10 ms for one hour and compare to the device. The
+	// clocks have exactly the same rate.
+	Client client(bus, 60000000000ULL, 0, fake_clock);
+	unsigned int n_wrong = 0, n_late = 0;
+	for (unsigned int i = 0; i < 360000; i++) {
+		const int64_t truth = epoch0 + int64_t((fake_now - origin) / 1000000000ULL);
+		int64_t t;
+		ASSERT_TRUE(client.time(t));
+		EXPECT_TRUE(t <= truth);
+		EXPECT_TRUE(t >= truth - 1);
+		if (t != truth) {
+			n_wrong++;
+			if (i >= 60000) {
+				n_late++;
+			}
+		}
+		fake_now += 10000000ULL;
+	}
+
+	// Once per minute instead of 360000 bus transactions; the extrapolation
+	// converged after a few reads
+	EXPECT_TRUE(bus.transactions() <= 62U);
+	EXPECT_EQ(bus.transactions(), client.reads());
+	EXPECT_TRUE(client.uncertainty() <= 10000000LL);
+	EXPECT_TRUE(n_wrong < 6000U);
+	EXPECT_EQ(0U, n_late);
+}
+
+void test_client_set_epoch()
+{
+	fake_now = 5000000000ULL;
+	Bus bus(fake_clock);
+	Client client(bus, 60000000000ULL, 100, fake_clock);
+
+	// Setting the time is effective right away and restarts the second
+	fake_now += 700000000ULL;
+	const int64_t epoch = 1700000000LL;
+	EXPECT_TRUE(client.set_epoch(epoch));
+	EXPECT_TRUE(bus.rtc().epoch() == epoch);
+	for (unsigned int i = 0; i < 2000; i++) {
+		int64_t t;
+		ASSERT_TRUE(client.time(t));
+		EXPECT_TRUE(t == epoch + int64_t(i / 100));
+		fake_now += 10000000ULL;
+	}
+	EXPECT_EQ(1U, bus.transactions());
+
+	// A time change behind the back of the client is picked up with the next
+	// read
+	const uint8_t minutes = 0x30;
+	bus.write(0x01, &minutes, 1);
+	fake_now += 60000000000ULL;
+	int64_t t;
+	ASSERT_TRUE(client.time(t));
+	EXPECT_TRUE(t == bus.rtc().epoch());
+}
+
+int main()
+{
+	RUN(test_client_extrapolation);
+	RUN(test_client_set_epoch);
+	DONE;
+}
@@ -0,0 +1,202 @@
+/**
+ *  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <soft323x/soft323x_shm.hpp>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include <foxen/unittest.h>
+
+using Writer = Soft323xShmWriter<16>;
+using Reader = Soft323xShmReader<16>;
+
+static std::string temp_path()
+{
+	char path[] = "/tmp/test_soft323x_shm_XXXXXX";
+	const int fd = mkstemp(path);
+	close(fd);
+	return path;
+}
+
+/******************************************************************************
+ * MAIN                                                                       *
+ ******************************************************************************/
+
+void test_shm_read_write()
+{
+	const std::string path = temp_path();
+	{
+		Writer writer(path.c_str());
+		EXPECT_TRUE(writer.ok());
+
+		// Only one writer at a time
+		Writer writer2(path.c_str());
+		EXPECT_FALSE(writer2.ok());
+
+		Reader reader(path.c_str());
+		EXPECT_TRUE(reader.ok());
+
+		uint8_t regs[7];
+		reader.read(0x00, regs, 7);
+		EXPECT_EQ(0x00, regs[1]);
+		EXPECT_EQ(0x00, regs[2]);
+		EXPECT_EQ(0x02, regs[3]);
+		EXPECT_EQ(0x01, regs[4]);
+		EXPECT_EQ(0x81, regs[5]);
+		EXPECT_EQ(0x19, regs[6]);
+
+		writer.i2c_write(0x01, 0x42);
+		writer.i2c_write(0x14, 0xAB);
+		reader.read(0x01, regs, 1);
+		EXPECT_EQ(0x42, regs[0]);
+		reader.read(0x14, regs, 1);
+		EXPECT_EQ(0xAB, regs[0]);
+	}
+
+	// The state survives a restart of the writer
+	{
+		Writer writer(path.c_str());
+		EXPECT_TRUE(writer.ok());
+		EXPECT_EQ(0x42, writer.rtc().i2c_read(0x01));
+		EXPECT_EQ(0xAB, writer.rtc().i2c_read(0x14));
+	}
+	unlink(path.c_str());
+
+	// Readers cannot open non-existing segments
+	Reader reader(path.c_str());
+	EXPECT_FALSE(reader.ok());
+}
+
+void test_shm_consistency()
+{
+	const std::string path = temp_path();
+	Writer writer(path.c_str());
+	Reader reader(path.c_str());
+
+	// The writer fills the SRAM with the same value over and over again,
+	// readers must never see a mix of two values
+	std::atomic<bool> done{false};
+	std::thread thread([&]() {
+		for (unsigned int i = 0; i < 20000; i++) {
+			for (uint8_t j = 0; j < 16; j++) {
+				writer.rtc().i2c_write(0x14 + j, uint8_t(i));
+			}
+			writer.sync();
+		}
+		done = true;
+	});
+	unsigned int n_inconsistent = 0;
+	while (!done) {
+		uint8_t sram[16];
+		reader.read(0x14, sram, 16);
+		for (uint8_t j = 1; j < 16; j++) {
+			if (sram[j] != sram[0]) {
+				n_inconsistent++;
+			}
+		}
+	}
+	thread.join();
+	EXPECT_EQ(0U, n_inconsistent);
+	unlink(path.c_str());
+}
+
+void test_shm_writer_crash()
+{
+	const std::string path = temp_path();
+	{
+		Writer writer(path.c_str());
+		writer.i2c_write(0x01, 0x42);
+	}
+
+	// Simulate a writer that crashed in the middle of publish()
+	using Segment = Writer::Segment;
+	const int fd = open(path.c_str(), O_RDWR);
+	Segment *seg = static_cast<Segment *>(mmap(nullptr, sizeof(Segment),
+	                                           PROT_READ | PROT_WRITE,
+	                                           MAP_SHARED, fd, 0));
+	close(fd);
+	ASSERT_TRUE(seg != MAP_FAILED);
+	seg->seq.store(seg->seq.load() + 1U);
+	EXPECT_EQ(1U, seg->seq.load() & 1U);
+
+	// The restarted writer leaves the sequence number even after publishing
+	{
+		Writer writer(path.c_str());
+		EXPECT_TRUE(writer.ok());
+		EXPECT_EQ(0U, seg->seq.load() & 1U);
+		writer.i2c_write(0x01, 0x43);
+		EXPECT_EQ(0U, seg->seq.load() & 1U);
+
+		Reader reader(path.c_str());
+		uint8_t reg = 0;
+		reader.read(0x01, &reg, 1);
+		EXPECT_EQ(0x43, reg);
+	}
+	munmap(seg, sizeof(Segment));
+	unlink(path.c_str());
+}
+
+void test_shm_reboot()
+{
+	const std::string path = temp_path();
+	int64_t epoch = 0;
+	{
+		Writer writer(path.c_str());
+		epoch = writer.rtc().epoch();
+	}
+
+	// Simulate a reboot: the boot ID changed and the monotonic time of the
+	// origin belongs to the previous boot
+	using Segment = Writer::Segment;
+	const int fd = open(path.c_str(), O_RDWR);
+	Segment *seg = static_cast<Segment *>(mmap(nullptr, sizeof(Segment),
+	                                           PROT_READ | PROT_WRITE,
+	                                           MAP_SHARED, fd, 0));
+	close(fd);
+	ASSERT_TRUE(seg != MAP_FAILED);
+	seg->boot_id[0] ^= 1;
+	seg->origin = 0;
+	seg->ticks = 0;
+
+	// The clock continues from the stored time instead of jumping ahead by
+	// the uptime
+	{
+		Writer writer(path.c_str());
+		EXPECT_TRUE(writer.ok());
+		EXPECT_TRUE(writer.rtc().epoch() - epoch <= 1);
+		EXPECT_TRUE(seg->origin > 0U);
+	}
+	munmap(seg, sizeof(Segment));
+	unlink(path.c_str());
+}
+
+int main()
+{
+	RUN(test_shm_read_write);
+	RUN(test_shm_consistency);
+	RUN(test_shm_writer_crash);
+	RUN(test_shm_reboot);
+	DONE;
+}
@@ -0,0 +1,167 @@
+/**
+ *  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <soft323x/soft323x_spi.hpp>
+
+#include <vector>
+
+#include <foxen/unittest.h>
+
+using RTC = Soft323x<16>;
+using SPI = Soft323xSpi<RTC>;
+
+/**
+ * Simulates a full-duplex SPI frame: asserts chip select, shifts out the
+ * given bytes and returns the bytes shifted in. As with a hardware SPI slave,
+ * the byte sent during the first transfer is the stale content of the data
+ * register (zero here).
+ */
+static std::vector<uint8_t> spi_frame(SPI &spi, std::vector<uint8_t> mosi,
+                                      uint8_t *actions = nullptr)
+{
+	std::vector<uint8_t> miso;
+	uint8_t spdr = 0;
+	spi.select();
+	for (uint8_t byte : mosi) {
+		miso.push_back(spdr);
+		spdr = spi.transfer(byte);
+	}
+	const uint8_t res = spi.deselect();
+	if (actions) {
+		*actions = res;
+	}
+	return miso;
+}
+
+/******************************************************************************
+ * MAIN                                                                       *
+ ******************************************************************************/
+
+void test_spi_read()
+{
+	RTC rtc;
+	SPI spi(rtc);
+
+	// ds3234_read_time(): address byte followed by seven dummy bytes
+	std::vector<uint8_t> miso = spi_frame(spi, {0x00, 0, 0, 0, 0, 0, 0, 0});
+	ASSERT_EQ(8U, miso.size());
+	for (uint8_t i = 0; i < 7; i++) {
+		EXPECT_EQ(rtc.i2c_read(i), miso[i + 1]);
+	}
+	EXPECT_EQ(0x19, miso[7]);
+
+	// Selecting the chip commits the pending ticks
+	for (int i = 0; i < 5; i++) {
+		rtc.tick();
+	}
+	miso = spi_frame(spi, {0x00, 0});
+	EXPECT_EQ(0x05, miso[1]);
+	EXPECT_FALSE(spi.active());
+
+	// Reads wrap from 13h to 00h and update the clock
+	rtc.tick();
+	miso = spi_frame(spi, {0x12, 0, 0, 0});
+	EXPECT_EQ(rtc.i2c_read(0x12), miso[1]);
+	EXPECT_EQ(rtc.i2c_read(0x13), miso[2]);
+	EXPECT_EQ(0x06, miso[3]);
+	rtc.tick();
+	miso = spi_frame(spi, {0x13, 0, 0});
+	EXPECT_EQ(0x07, miso[2]);
+}
+
+void test_spi_write()
+{
+	RTC rtc;
+	SPI spi(rtc);
+
+	// ds3234_set_time(): burst write of the time registers
+	uint8_t actions = 0;
+	spi_frame(spi, {0x80, 0x56, 0x34, 0x12, 0x05, 0x17, 0x08, 0x21},
+	          &actions);
+	EXPECT_EQ(rtc.ACTION_RESET_TIMER, actions);
+	EXPECT_EQ(0x56, rtc.i2c_read(0x00));
+	EXPECT_EQ(0x34, rtc.i2c_read(0x01));
+	EXPECT_EQ(0x12, rtc.i2c_read(0x02));
+	EXPECT_EQ(0x05, rtc.i2c_read(0x03));
+	EXPECT_EQ(0x17, rtc.i2c_read(0x04));
+	EXPECT_EQ(0x08, rtc.i2c_read(0x05));
+	EXPECT_EQ(0x21, rtc.i2c_read(0x06));
+
+	// Single register writes do not reset the timer
+	spi_frame(spi, {0x8E, 0x1C}, &actions);
+	EXPECT_EQ(0, actions);
+	EXPECT_EQ(0x1C, rtc.i2c_read(0x0E));
+	EXPECT_EQ(0x1C, spi_frame(spi, {0x0E, 0})[1]);
+}
+
+void test_spi_sram()
+{
+	RTC rtc;
+	SPI spi(rtc);
+
+	// Write three bytes starting at SRAM address 02h
+	spi_frame(spi, {0x98, 0x02});
+	spi_frame(spi, {0x99, 0xAA, 0xBB, 0xCC});
+	EXPECT_EQ(0xAA, rtc.i2c_read(rtc.REG_SRAM + 2));
+	EXPECT_EQ(0xBB, rtc.i2c_read(rtc.REG_SRAM + 3));
+	EXPECT_EQ(0xCC, rtc.i2c_read(rtc.REG_SRAM + 4));
+	EXPECT_EQ(0x05, spi_frame(spi, {0x18, 0})[1]);
+
+	// Read them back; the prefetched byte does not advance the address
+	spi_frame(spi, {0x98, 0x02});
+	std::vector<uint8_t> miso = spi_frame(spi, {0x19, 0, 0, 0});
+	EXPECT_EQ(0xAA, miso[1]);
+	EXPECT_EQ(0xBB, miso[2]);
+	EXPECT_EQ(0xCC, miso[3]);
+	EXPECT_EQ(0x05, spi_frame(spi, {0x18, 0})[1]);
+
+	// Unused registers read as zero and ignore writes
+	spi_frame(spi, {0x94, 0xFF});
+	EXPECT_EQ(0x00, spi_frame(spi, {0x14, 0})[1]);
+}
+
+void test_spi_reset_timer()
+{
+	RTC rtc;
+	SPI spi(rtc);
+
+	// The reset is requested right after the seconds byte, not only when
+	// the chip select line is released
+	spi.select();
+	spi.transfer(0x80);
+	EXPECT_EQ(0, spi.consume_actions());
+	spi.transfer(0x30);
+	EXPECT_EQ(rtc.ACTION_RESET_TIMER, spi.consume_actions());
+	rtc.tick();  // First tick of the restarted second
+	spi.transfer(0x10);
+	spi.transfer(0x12);
+	EXPECT_EQ(0, spi.consume_actions());
+	EXPECT_EQ(0, spi.deselect());
+	rtc.update();
+	EXPECT_EQ(0x31, rtc.i2c_read(0x00));
+	EXPECT_EQ(0x10, rtc.i2c_read(0x01));
+}
+
+int main()
+{
+	RUN(test_spi_read);
+	RUN(test_spi_write);
+	RUN(test_spi_sram);
+	RUN(test_spi_reset_timer);
+	DONE;
+}
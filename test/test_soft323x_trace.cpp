@@ -0,0 +1,188 @@
+/**
+ *  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <soft323x/soft323x_trace.hpp>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <foxen/unittest.h>
+
+using RTC = Soft323x<16>;
+
+static std::string temp_path()
+{
+	char path[] = "/tmp/test_soft323x_trace_XXXXXX";
+	const int fd = mkstemp(path);
+	close(fd);
+	return path;
+}
+
+static std::vector<uint8_t> read_file(const std::string &path)
+{
+	std::vector<uint8_t> data;
+	FILE *f = fopen(path.c_str(), "rb");
+	int c;
+	while ((c = fgetc(f)) != EOF) {
+		data.push_back(uint8_t(c));
+	}
+	fclose(f);
+	return data;
+}
+
+/**
+ * Drives a device and records the calls in the trace.
+ */
+struct Recorder {
+	RTC rtc;
+	Soft323xTraceWriter trace;
+
+	explicit Recorder(const char *path) : trace(path) {}
+
+	void ticks(uint32_t n)
+	{
+		trace.tick(n);
+		while (n > 0) {
+			const uint32_t k = (n > 255) ? 255 : n;
+			for (uint32_t i = 0; i < k; i++) {
+				rtc.tick();
+			}
+			n -= k;
+			if (n > 0) {
+				rtc.update();
+			}
+		}
+	}
+
+	void update()
+	{
+		trace.update();
+		rtc.update();
+	}
+
+	void read_burst(uint8_t addr, uint8_t n)
+	{
+		trace.start();
+		rtc.update();
+		for (uint8_t i = 0; i < n; i++) {
+			trace.read(addr, rtc.i2c_read(addr));
+			addr = rtc.i2c_next_addr(addr);
+		}
+		trace.stop();
+	}
+
+	void write_burst(uint8_t addr, std::vector<uint8_t> data)
+	{
+		trace.start();
+		rtc.update();
+		for (uint8_t value : data) {
+			trace.write(addr, value);
+			rtc.i2c_write(addr, value);
+			addr = rtc.i2c_next_addr(addr);
+		}
+		trace.stop();
+	}
+};
+
+/******************************************************************************
+ * MAIN                                                                       *
+ ******************************************************************************/
+
+void test_trace_encoding()
+{
+	const std::string path = temp_path();
+	{
+		Recorder rec(path.c_str());
+		EXPECT_TRUE(rec.trace.ok());
+		rec.read_burst(0x00, 7);
+	}
+
+	// Magic, START, seven reads with the address delta zero, STOP
+	const std::vector<uint8_t> data = read_file(path);
+	ASSERT_EQ(8U + 1U + 14U + 1U, data.size());
+	EXPECT_EQ('S', data[0]);
+	EXPECT_EQ(Soft323xTrace::EV_START, data[8]);
+	for (unsigned int i = 0; i < 7; i++) {
+		EXPECT_EQ(Soft323xTrace::EV_READ, data[9 + 2 * i]);
+	}
+	EXPECT_EQ(Soft323xTrace::EV_STOP, data[23]);
+	unlink(path.c_str());
+}
+
+void test_trace_replay()
+{
+	const std::string path = temp_path();
+	Recorder rec(path.c_str());
+	{
+		rec.write_burst(0x00, {0x56, 0x34, 0x12, 0x05, 0x17, 0x08, 0x21});
+		rec.write_burst(0x07, {0x80, 0x80, 0x80, 0x80});
+		rec.write_burst(0x14, {0xAA, 0xBB});
+		rec.write_burst(0x0F, {0x00});
+		for (int i = 0; i < 1000; i++) {
+			rec.ticks(1 + (i % 40));
+			rec.update();
+			rec.read_burst((i % 3) ? 0x00 : 0x0E, 7);
+			if (i % 100 == 0) {
+				rec.write_burst(0x0F, {0x00});  // Clear the alarm flags
+			}
+		}
+		rec.ticks(100000);
+		rec.update();
+		rec.read_burst(0xFE, 4);
+		rec.trace.flush();
+	}
+
+	Soft323xTraceReader reader(path.c_str());
+	ASSERT_TRUE(reader.ok());
+	RTC rtc;
+	const Soft323xTraceReader::Result res = reader.replay(rtc);
+	EXPECT_FALSE(res.invalid);
+	EXPECT_EQ(0U, res.mismatches);
+	EXPECT_EQ(120500U, res.ticks);
+	// The SRAM is not initialised; compare the registers and the bytes written
+	for (unsigned int i = 0; i < 0x14 + 2; i++) {
+		EXPECT_EQ(rec.rtc.i2c_read(uint8_t(i)), rtc.i2c_read(uint8_t(i)));
+	}
+
+	// Modified reads are reported, truncated traces are detected
+	std::vector<uint8_t> data = read_file(path);
+	data[data.size() - 2] ^= 0x01;  // Last value read, followed by STOP
+	{
+		RTC rtc2;
+		Soft323xTraceReader mem(data.data(), data.size());
+		const Soft323xTraceReader::Result r = mem.replay(rtc2);
+		EXPECT_FALSE(r.invalid);
+		EXPECT_TRUE(r.mismatches > 0);
+	}
+	{
+		RTC rtc2;
+		Soft323xTraceReader mem(data.data(), data.size() - 2);
+		EXPECT_TRUE(mem.replay(rtc2).invalid);
+	}
+	unlink(path.c_str());
+}
+
+int main()
+{
+	RUN(test_trace_encoding);
+	RUN(test_trace_replay);
+	DONE;
+}
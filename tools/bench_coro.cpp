@@ -0,0 +1,187 @@
+/**
+ *  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file bench_coro.cpp
+ *
+ * Measures the number of simulated I2C transactions per second of wall-clock
+ * time for many virtual devices driven by coroutines, using the
+ * single-threaded executor and the work-stealing executor with an increasing
+ * number of threads. Every client checks that the time it reads matches the
+ * number of ticks it awaited.
+ */
+
+#include <soft323x/soft323x_coro.hpp>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using Device = Soft323xDevice<>;
+
+static constexpr uint64_t NS = 1;
+static constexpr uint64_t MS = 1000000ULL * NS;
+static constexpr uint64_t S = 1000ULL * MS;
+
+struct Counters {
+	std::atomic<uint64_t> transactions{0};
+	std::atomic<uint64_t> errors{0};
+};
+
+/**
+ * Client polling the time registers of a device every 10ms (with a
+ * device-specific offset), waiting for a tick and setting the alarm register
+ * once per virtual second.
+ */
+static Soft323xTask client(Device &dev, uint64_t offs, Counters &counters)
+{
+	uint64_t n_tx = 0, n_err = 0;
+	uint8_t regs[7];
+	co_await dev.sleep_for(offs);
+	while (true) {
+		for (int i = 0; i < 100; i++) {
+			co_await dev.read_burst(0x00, regs, 7);
+			co_await dev.sleep_for(10 * MS);
+			n_tx++;
+		}
+
+		// Wait for the next second and make sure it was counted
+		co_await dev.read_burst(0x00, regs, 1);
+		const uint8_t sec = regs[0];
+		co_await dev.tick();
+		co_await dev.read_burst(0x00, regs, 1);
+		const uint8_t expected = (sec == 0x59) ? 0x00
+		                         : ((sec & 0x0F) == 9) ? (sec + 7) : (sec + 1);
+		if (regs[0] != expected) {
+			n_err++;
+		}
+
+		const uint8_t alarm[4] = {0x30, 0x00, 0x00, 0x80};
+		co_await dev.write_burst(0x07, alarm, 4);
+		n_tx += 3;
+
+		counters.transactions.fetch_add(n_tx, std::memory_order_relaxed);
+		counters.errors.fetch_add(n_err, std::memory_order_relaxed);
+		n_tx = n_err = 0;
+	}
+}
+
+static double run(Soft323xExecutor &executor, size_t n_devices, uint64_t t_end,
+                  Counters &counters)
+{
+	std::vector<std::unique_ptr<Device>> devices;
+	for (size_t i = 0; i < n_devices; i++) {
+		const uint64_t phase = S + (i * 7919ULL * MS) % S;
+		devices.emplace_back(new Device(S, phase));
+		client(*devices.back(), (i * 104729ULL) % (10 * MS), counters)
+		    .spawn(executor);
+	}
+
+	// The clients never return; their frames are destroyed together with the
+	// executor
+	const auto t0 = std::chrono::steady_clock::now();
+	executor.run(t_end);
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0)
+	    .count();
+}
+
+/**
+ * Parses a positive decimal integer. Returns false if the string is not
+ * entirely a number greater than zero.
+ */
+static bool parse_count(const char *str, size_t &res)
+{
+	char *end;
+	errno = 0;
+	const unsigned long value = std::strtoul(str, &end, 10);
+	if (end == str || *end != '\0' || errno != 0 || value == 0 ||
+	    str[0] == '-') {
+		return false;
+	}
+	res = value;
+	return true;
+}
+
+/**
+ * Parses a positive duration in seconds that fits into the virtual clock.
+ */
+static bool parse_seconds(const char *str, double &res)
+{
+	char *end;
+	errno = 0;
+	const double value = std::strtod(str, &end);
+	if (end == str || *end != '\0' || errno != 0 || !std::isfinite(value) ||
+	    value <= 0.0 || value > 1e9) {
+		return false;
+	}
+	res = value;
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t n_devices = 4096;
+	double seconds = 10.0;
+	size_t n_cores = std::max(1U, std::thread::hardware_concurrency());
+	const bool help = argc > 1 && (std::strcmp(argv[1], "--help") == 0 ||
+	                               std::strcmp(argv[1], "-h") == 0);
+	if (help || argc > 4 || (argc > 1 && !parse_count(argv[1], n_devices)) ||
+	    (argc > 2 && !parse_seconds(argv[2], seconds)) ||
+	    (argc > 3 && !parse_count(argv[3], n_cores))) {
+		fprintf(help ? stdout : stderr,
+		        "Usage: %s [DEVICES [SECONDS [THREADS]]]\n"
+		        "  DEVICES  number of virtual devices (default 4096)\n"
+		        "  SECONDS  virtual time to simulate (default 10)\n"
+		        "  THREADS  maximum number of work-stealing threads "
+		        "(default: all cores)\n",
+		        argv[0]);
+		return help ? 0 : 1;
+	}
+	const uint64_t t_end = uint64_t(seconds * S);
+
+	printf("# %zu devices, %.1f s of virtual time\n", n_devices, seconds);
+	printf("# %-14s %8s %12s %12s %8s\n", "executor", "threads", "tx", "tx/s",
+	       "errors");
+
+	{
+		Counters counters;
+		Soft323xSingleThreadExecutor executor;
+		const double t = run(executor, n_devices, t_end, counters);
+		printf("%-16s %8d %12llu %12.4g %8llu\n", "single", 1,
+		       (unsigned long long)counters.transactions,
+		       counters.transactions / t,
+		       (unsigned long long)counters.errors);
+	}
+	for (size_t n = 1; n <= n_cores; n *= 2) {
+		Counters counters;
+		Soft323xWorkStealingExecutor executor(n, 10 * MS);
+		const double t = run(executor, n_devices, t_end, counters);
+		printf("%-16s %8zu %12llu %12.4g %8llu\n", "work-stealing", n,
+		       (unsigned long long)counters.transactions,
+		       counters.transactions / t,
+		       (unsigned long long)counters.errors);
+	}
+	return 0;
+}
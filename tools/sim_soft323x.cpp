@@ -0,0 +1,975 @@
+/**
+ *  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file sim_soft323x.cpp
+ *
+ * Discrete-event co-simulation of the AVR example (timer ISR, TWI slave ISR
+ * and main loop), the I2C bus and the access patterns of the Linux
+ * rtc-ds1307/rtc-ds3232 drivers. All events are scheduled in virtual time,
+ * measured in CPU cycles, using a priority queue. The Soft323x instance is
+ * the same as on the microcontroller. The TWI state machine is a simplified
+ * copy of the one in the example, serving a single device without PEC, and
+ * must be kept in sync with it by hand. The execution time of the ISRs is
+ * modelled by the cycle counts given on the command line.
+ *
+ * Reports the end-to-end latency of the driver requests, the fraction of CPU
+ * time spent in ISRs, the probability of a timer tick being lost because the
+ * timer ISR did not run before the next compare match, and the probability of
+ * the host reading a time that lags behind the timer.
+ *
+ * For judging the energy consumption on backup power, the number of wakeups
+ * from sleep and the number of cycles the CPU is awake are reported per
+ * simulated day. These can be compared for per-second and coalesced timer
+ * ticks, with and without a periodic alarm serviced by the host, and for
+ * different polling intervals.
+ */
+
+#include <soft323x/soft323x.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+/******************************************************************************
+ * Parameters                                                                 *
+ ******************************************************************************/
+
+struct Params {
+	double days = 1.0;             // Simulated time per polling load
+	uint32_t f_cpu = 8000000;      // CPU clock in Hz
+	uint32_t f_scl = 100000;       // I2C clock in Hz
+	uint32_t timer_period = 256UL * 31250UL;  // Cycles per tick
+	uint32_t c_tick = 40;          // Cycles of the timer ISR
+	uint32_t c_twi = 120;          // Cycles of the TWI ISR
+	uint32_t c_update = 400;       // Cycles of Soft323x::update()
+	uint32_t c_main = 30;          // Cycles of one main loop iteration
+	uint32_t c_wake = 8;           // Cycles to wake up from sleep
+	double jitter = 0.1;           // Relative jitter of the polling interval
+	double set_interval = 660.0;   // Seconds between set_time (11 min mode)
+	uint64_t seed = 4711;
+	std::vector<double> polls = {1000.0, 100.0, 10.0};  // Poll intervals (ms)
+	std::vector<uint32_t> coalesce = {1};  // Seconds per timer interrupt
+	std::vector<uint32_t> alarms = {0};    // Alarm 1 once per minute if 1
+};
+
+/******************************************************************************
+ * Event scheduler                                                            *
+ ******************************************************************************/
+
+enum EventType : uint8_t {
+	EV_TIMER_COMPARE,
+	EV_BUS_DONE,
+	EV_CPU_DONE,
+	EV_HOST_REQUEST,
+	EV_HOST_SET_TIME,
+	EV_HOST_ALARM,
+};
+
+struct Event {
+	uint64_t t;
+	uint64_t seq;
+	EventType type;
+	uint32_t arg;
+
+	bool operator>(const Event &o) const
+	{
+		return (t != o.t) ? (t > o.t) : (seq > o.seq);
+	}
+};
+
+class Scheduler {
+private:
+	std::priority_queue<Event, std::vector<Event>, std::greater<Event>> m_queue;
+	uint64_t m_seq = 0;
+	uint64_t m_now = 0;
+
+public:
+	uint64_t now() const { return m_now; }
+
+	void schedule(uint64_t t, EventType type, uint32_t arg = 0)
+	{
+		m_queue.push(Event{t, m_seq++, type, arg});
+	}
+
+	bool pop(Event &ev)
+	{
+		if (m_queue.empty()) {
+			return false;
+		}
+		ev = m_queue.top();
+		m_queue.pop();
+		m_now = ev.t;
+		return true;
+	}
+};
+
+/******************************************************************************
+ * Statistics                                                                 *
+ ******************************************************************************/
+
+/**
+ * Latency histogram with a resolution of one microsecond.
+ */
+class Histogram {
+private:
+	std::vector<uint64_t> m_bins = std::vector<uint64_t>(100000);
+	uint64_t m_n = 0;
+	double m_sum = 0.0;
+	double m_max = 0.0;
+
+public:
+	void add(double us)
+	{
+		const size_t i = std::min<size_t>(size_t(us), m_bins.size() - 1);
+		m_bins[i]++;
+		m_n++;
+		m_sum += us;
+		m_max = std::max(m_max, us);
+	}
+
+	uint64_t n() const { return m_n; }
+	double mean() const { return m_n ? (m_sum / m_n) : 0.0; }
+	double max() const { return m_max; }
+
+	double percentile(double p) const
+	{
+		const uint64_t k = uint64_t(p * m_n);
+		uint64_t acc = 0;
+		for (size_t i = 0; i < m_bins.size(); i++) {
+			acc += m_bins[i];
+			if (acc > k) {
+				return double(i);
+			}
+		}
+		return double(m_bins.size());
+	}
+};
+
+struct Stats {
+	Histogram latency;
+	uint64_t ticks = 0;
+	uint64_t missed_ticks = 0;
+	uint64_t isr_cycles = 0;
+	uint64_t max_tick_latency = 0;
+	uint64_t reads = 0;
+	uint64_t stale_reads = 0;
+	uint64_t updates = 0;
+	uint64_t wakeups = 0;
+	uint64_t awake_cycles = 0;
+	uint64_t alarms = 0;
+	uint64_t max_alarm_latency = 0;
+};
+
+/******************************************************************************
+ * Calendar helpers                                                           *
+ ******************************************************************************/
+
+static uint8_t bcd(unsigned int x) { return ((x / 10) << 4) | (x % 10); }
+static unsigned int unbcd(uint8_t x) { return (x >> 4) * 10 + (x & 0x0F); }
+
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d)
+{
+	y -= m <= 2;
+	const int64_t era = (y >= 0 ? y : y - 399) / 400;
+	const unsigned yoe = unsigned(y - era * 400);
+	const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + int64_t(doe) - 719468;
+}
+
+/**
+ * Converts the time registers 00h-06h (24 hour mode) to a UNIX timestamp.
+ */
+static int64_t regs_to_epoch(const uint8_t *r)
+{
+	const unsigned int year =
+	    1900 + unbcd(r[6]) + ((r[5] & 0x80) ? 100 : 0);
+	const int64_t days =
+	    days_from_civil(year, unbcd(r[5] & 0x1F), unbcd(r[4]));
+	return days * 86400 + unbcd(r[2] & 0x3F) * 3600 + unbcd(r[1]) * 60 +
+	       unbcd(r[0]);
+}
+
+static void epoch_to_regs(int64_t t, uint8_t *r)
+{
+	int64_t z = t / 86400 + 719468;
+	const unsigned int sod = unsigned(t % 86400);
+	const int64_t era = z / 146097;
+	const unsigned doe = unsigned(z - era * 146097);
+	const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	const unsigned mp = (5 * doy + 2) / 153;
+	const unsigned d = doy - (153 * mp + 2) / 5 + 1;
+	const unsigned m = mp < 10 ? mp + 3 : mp - 9;
+	const int64_t y = int64_t(yoe) + era * 400 + (m <= 2);
+	r[0] = bcd(sod % 60);
+	r[1] = bcd((sod / 60) % 60);
+	r[2] = bcd(sod / 3600);
+	r[3] = uint8_t(((t / 86400 + 3) % 7) + 1);  // 1970-01-01 was a Thursday
+	r[4] = bcd(d);
+	r[5] = bcd(m) | ((y >= 2000) ? 0x80 : 0x00);
+	r[6] = bcd(unsigned(y % 100));
+}
+
+/******************************************************************************
+ * Microcontroller model                                                      *
+ ******************************************************************************/
+
+/**
+ * Alarm 1 registers 07h-0Ah matching at second zero of every minute.
+ */
+static const uint8_t ALARM_EVERY_MINUTE[4] = {0x00, 0x80, 0x80, 0x80};
+
+/**
+ * TWI status codes of the AVR in slave mode.
+ */
+enum TwStatus : uint8_t {
+	TW_SR_SLA_ACK = 0x60,
+	TW_SR_DATA_ACK = 0x80,
+	TW_SR_STOP = 0xA0,
+	TW_ST_SLA_ACK = 0xA8,
+	TW_ST_DATA_ACK = 0xB8,
+	TW_ST_DATA_NACK = 0xC0,
+};
+
+class Mcu {
+public:
+	static constexpr uint8_t I2C_IDLE = 0;
+	static constexpr uint8_t I2C_START = 1;
+	static constexpr uint8_t I2C_HAS_ADDR = 2;
+	static constexpr uint8_t I2C_SEND_READY = 3;
+	static constexpr uint8_t I2C_SEND_BYTE = 4;
+	static constexpr uint8_t I2C_RECV_BYTE = 5;
+
+	enum Activity : uint8_t { CPU_IDLE, CPU_TIMER_ISR, CPU_TWI_ISR, CPU_MAIN };
+
+private:
+	const Params &m_params;
+	Scheduler &m_sched;
+	Stats &m_stats;
+
+	Soft323x<> m_rtc;
+
+	Activity m_activity = CPU_IDLE;
+	bool m_sleeping = true;
+	bool m_interrupt = false;
+	uint32_t m_coalesce;
+	uint32_t m_queued_ticks = 0;
+	bool m_timer_flag = false;
+	uint64_t m_timer_flag_t = 0;
+	uint32_t m_timer_gen = 0;
+	uint64_t m_timer_origin = 0;
+	bool m_twi_flag = false;
+	uint8_t m_twi_status = 0;
+	bool m_main_pending = false;
+
+	uint8_t m_i2c_addr = 0;
+	uint8_t m_i2c_status = I2C_IDLE;
+
+	int64_t m_epoch_base = 1546300800LL;  // 2019/01/01 00:00:00
+	int64_t m_epoch_written = 0;
+
+	void run(Activity activity, uint32_t cycles)
+	{
+		m_activity = activity;
+		if (activity != CPU_MAIN) {
+			m_stats.isr_cycles += cycles;
+		}
+		if (m_sleeping) {
+			m_sleeping = false;
+			m_stats.wakeups++;
+			cycles += m_params.c_wake;
+		}
+		m_stats.awake_cycles += cycles;
+		m_sched.schedule(m_sched.now() + cycles, EV_CPU_DONE, activity);
+	}
+
+	void i2c_commit_byte(uint8_t value)
+	{
+		if (m_rtc.i2c_write(m_i2c_addr, value) & m_rtc.ACTION_RESET_TIMER) {
+			timer_reset();
+		}
+		m_i2c_addr = m_rtc.i2c_next_addr(m_i2c_addr);
+	}
+
+	/**
+	 * Copy of i2c_state_machine() in examples/main_atmega168.cpp for a single
+	 * device without PEC. Returns the number of additional cycles spent in
+	 * the ISR.
+	 */
+	uint32_t i2c_state_machine(uint8_t tw_status)
+	{
+		uint32_t cycles = 0;
+		uint8_t next = I2C_IDLE;
+		switch (tw_status) {
+			case TW_SR_SLA_ACK:
+				m_i2c_addr = 0;
+				m_rtc.update();
+				cycles += m_params.c_update * std::max<uint32_t>(m_queued_ticks, 1);
+				m_queued_ticks = 0;
+				next = I2C_START;
+				break;
+			case TW_SR_DATA_ACK:
+				if (m_i2c_status == I2C_START) {
+					m_i2c_addr = twdr;
+					next = I2C_HAS_ADDR;
+				}
+				else if (m_i2c_status == I2C_HAS_ADDR ||
+				         m_i2c_status == I2C_RECV_BYTE) {
+					i2c_commit_byte(twdr);
+					next = I2C_RECV_BYTE;
+				}
+				break;
+			case TW_SR_STOP:
+				m_rtc.i2c_stop();
+				if (m_i2c_status == I2C_HAS_ADDR) {
+					next = I2C_SEND_READY;
+				}
+				break;
+			case TW_ST_SLA_ACK:
+			case TW_ST_DATA_ACK:
+				if (m_i2c_status == I2C_SEND_READY ||
+				    m_i2c_status == I2C_SEND_BYTE) {
+					twdr = m_rtc.i2c_read(m_i2c_addr);
+					m_i2c_addr = m_rtc.i2c_next_addr(m_i2c_addr);
+					next = I2C_SEND_BYTE;
+				}
+				break;
+		}
+		m_i2c_status = next;
+		return cycles;
+	}
+
+	void schedule_compare(uint64_t t)
+	{
+		m_sched.schedule(t, EV_TIMER_COMPARE, m_timer_gen);
+	}
+
+	/**
+	 * Mirrors int_update() in the example. Notifies the host on the falling
+	 * edge of the INT output and records the delay to the start of the second
+	 * the alarm matched in.
+	 */
+	void int_update()
+	{
+		const bool irq = m_rtc.interrupt();
+		if (irq && !m_interrupt) {
+			const int64_t e = expected_epoch(m_sched.now());
+			const int64_t e_match = e - ((e % 60) + 60) % 60;
+			const uint64_t t_match =
+			    m_timer_origin +
+			    uint64_t(e_match - m_epoch_base) * m_params.timer_period;
+			if (e_match >= m_epoch_base && t_match <= m_sched.now()) {
+				m_stats.max_alarm_latency = std::max<uint64_t>(
+				    m_stats.max_alarm_latency, m_sched.now() - t_match);
+			}
+			m_stats.alarms++;
+			m_sched.schedule(m_sched.now(), EV_HOST_ALARM);
+		}
+		m_interrupt = irq;
+	}
+
+public:
+	uint8_t twdr = 0;
+
+	Mcu(const Params &params, Scheduler &sched, Stats &stats,
+	    uint32_t coalesce, bool alarm)
+	    : m_params(params), m_sched(sched), m_stats(stats), m_coalesce(coalesce)
+	{
+		if (alarm) {
+			// Alarm armed by the host before the simulation starts
+			for (uint8_t i = 0; i < 4; i++) {
+				m_rtc.i2c_write(0x07 + i, ALARM_EVERY_MINUTE[i]);
+			}
+			m_rtc.i2c_write(0x0E, 0x05);  // INTCN | A1IE
+		}
+		schedule_compare(m_params.timer_period * m_coalesce);
+	}
+
+	/**
+	 * UNIX time the RTC should show according to the phase of the timer.
+	 */
+	int64_t expected_epoch(uint64_t t) const
+	{
+		return m_epoch_base + int64_t((t - m_timer_origin) /
+		                              m_params.timer_period);
+	}
+
+	/**
+	 * Announces the time the host is about to write to the time registers.
+	 */
+	void set_epoch_written(int64_t epoch) { m_epoch_written = epoch; }
+
+	void timer_reset()
+	{
+		// The written time becomes valid with the timer reset
+		m_epoch_base = m_epoch_written;
+		m_timer_origin = m_sched.now();
+		m_timer_gen++;
+		schedule_compare(m_sched.now() + m_params.timer_period * m_coalesce);
+	}
+
+	void timer_compare(uint32_t gen)
+	{
+		if (gen != m_timer_gen) {
+			return;  // Timer was reset in the meantime
+		}
+		schedule_compare(m_sched.now() + m_params.timer_period * m_coalesce);
+		m_stats.ticks += m_coalesce;
+		if (m_timer_flag) {
+			// OCF1A is still set, the ticks are lost
+			m_stats.missed_ticks += m_coalesce;
+		}
+		else {
+			m_timer_flag = true;
+			m_timer_flag_t = m_sched.now();
+		}
+		dispatch();
+	}
+
+	void twi_interrupt(uint8_t status)
+	{
+		m_twi_flag = true;
+		m_twi_status = status;
+		dispatch();
+	}
+
+	bool twi_busy() const { return m_twi_flag || m_activity == CPU_TWI_ISR; }
+
+	/**
+	 * Called when the current ISR or main loop section finished. Returns the
+	 * activity that just finished.
+	 */
+	Activity done()
+	{
+		const Activity res = m_activity;
+		m_activity = CPU_IDLE;
+		if (res != CPU_MAIN) {
+			m_main_pending = true;  // sleep_mode() returns after the ISR
+		}
+		return res;
+	}
+
+	/**
+	 * Selects the next activity of the CPU. Pending interrupts are served in
+	 * the order of their vector numbers; the main loop runs with interrupts
+	 * disabled, so it cannot be preempted.
+	 */
+	void dispatch()
+	{
+		if (m_activity != CPU_IDLE) {
+			return;
+		}
+		if (m_timer_flag) {
+			m_timer_flag = false;
+			m_stats.max_tick_latency = std::max<uint64_t>(
+			    m_stats.max_tick_latency, m_sched.now() - m_timer_flag_t);
+			for (uint32_t i = 0; i < m_coalesce; i++) {
+				m_rtc.tick();
+			}
+			m_queued_ticks += m_coalesce;
+			run(CPU_TIMER_ISR, m_params.c_tick);
+		}
+		else if (m_twi_flag) {
+			m_twi_flag = false;
+			const uint32_t extra = i2c_state_machine(m_twi_status);
+			run(CPU_TWI_ISR, m_params.c_twi + extra);
+		}
+		else if (m_main_pending) {
+			m_main_pending = false;
+			uint32_t cycles = m_params.c_main;
+			if (m_i2c_status == I2C_IDLE) {
+				m_rtc.update();
+				m_stats.updates++;
+				cycles += m_params.c_update * std::max<uint32_t>(m_queued_ticks, 1);
+				m_queued_ticks = 0;
+				int_update();
+			}
+			run(CPU_MAIN, cycles);
+		}
+		else {
+			m_sleeping = true;  // sleep_mode()
+		}
+	}
+};
+
+/******************************************************************************
+ * I2C bus and Linux driver model                                             *
+ ******************************************************************************/
+
+/**
+ * Individual bus operations issued by the I2C master.
+ */
+enum BusOp : uint8_t {
+	OP_START_W,   // START condition and address byte with write bit
+	OP_WRITE,     // Data byte written by the master
+	OP_RSTART,    // Repeated START condition
+	OP_ADDR_R,    // Address byte with read bit
+	OP_READ_ACK,  // Data byte read by the master, acknowledged
+	OP_READ_NACK, // Last data byte read by the master
+	OP_STOP,      // STOP condition
+};
+
+struct BusStep {
+	BusOp op;
+	uint8_t data;
+};
+
+/**
+ * Models the transactions of the Linux rtc-ds1307 and rtc-ds3232 drivers.
+ * Register reads use a register address write followed by a repeated start
+ * (regmap_bulk_read()), register writes a single write transaction.
+ */
+class Host {
+private:
+	const Params &m_params;
+	Scheduler &m_sched;
+	Stats &m_stats;
+	Mcu &m_mcu;
+	std::mt19937_64 m_rng;
+
+	struct Request {
+		uint64_t t;
+		std::vector<BusStep> steps;
+		bool is_time_read;
+	};
+
+	std::deque<Request> m_requests;
+	size_t m_step = 0;
+	bool m_active = false;
+	bool m_waiting_for_slave = false;
+	bool m_slave_addressed = false;
+	std::vector<uint8_t> m_data;
+	int64_t m_expected = 0;
+
+	uint64_t bits(uint32_t n) const
+	{
+		return (uint64_t(n) * m_params.f_cpu + m_params.f_scl - 1) /
+		       m_params.f_scl;
+	}
+
+	static void read_regs(std::vector<BusStep> &steps, uint8_t addr,
+	                      uint8_t n)
+	{
+		steps.push_back({OP_START_W, 0});
+		steps.push_back({OP_WRITE, addr});
+		steps.push_back({OP_RSTART, 0});
+		steps.push_back({OP_ADDR_R, 0});
+		for (uint8_t i = 0; i < n; i++) {
+			steps.push_back({(i + 1 < n) ? OP_READ_ACK : OP_READ_NACK, 0});
+		}
+		steps.push_back({OP_STOP, 0});
+	}
+
+	static void write_regs(std::vector<BusStep> &steps, uint8_t addr,
+	                       const uint8_t *data, uint8_t n)
+	{
+		steps.push_back({OP_START_W, 0});
+		steps.push_back({OP_WRITE, addr});
+		for (uint8_t i = 0; i < n; i++) {
+			steps.push_back({OP_WRITE, data[i]});
+		}
+		steps.push_back({OP_STOP, 0});
+	}
+
+	void submit(std::vector<BusStep> steps, bool is_time_read)
+	{
+		m_requests.push_back(
+		    Request{m_sched.now(), std::move(steps), is_time_read});
+		if (!m_active) {
+			start();
+		}
+	}
+
+	void start()
+	{
+		if (m_requests.empty()) {
+			m_active = false;
+			return;
+		}
+		m_active = true;
+		m_step = 0;
+		m_data.clear();
+		next();
+	}
+
+	void finish()
+	{
+		const Request &req = m_requests.front();
+		m_stats.latency.add(double(m_sched.now() - req.t) * 1e6 /
+		                    m_params.f_cpu);
+		if (req.is_time_read) {
+			m_stats.reads++;
+			if (regs_to_epoch(m_data.data()) != m_expected) {
+				m_stats.stale_reads++;
+			}
+		}
+		m_requests.pop_front();
+		start();
+	}
+
+	/**
+	 * Performs the next bus operation of the current request.
+	 */
+	void next()
+	{
+		const Request &req = m_requests.front();
+		if (m_step >= req.steps.size()) {
+			finish();
+			return;
+		}
+		const BusStep &s = req.steps[m_step];
+		uint64_t duration = 0;
+		switch (s.op) {
+			case OP_START_W:
+				duration = bits(10);
+				break;
+			case OP_RSTART:
+			case OP_STOP:
+				duration = bits(1);
+				break;
+			default:
+				duration = bits(9);
+				break;
+		}
+		if (s.op == OP_READ_ACK || s.op == OP_READ_NACK) {
+			if (m_data.empty()) {
+				m_expected = m_mcu.expected_epoch(m_sched.now());
+			}
+			m_data.push_back(m_mcu.twdr);
+		}
+		m_sched.schedule(m_sched.now() + duration, EV_BUS_DONE);
+	}
+
+public:
+	Host(const Params &params, Scheduler &sched, Stats &stats, Mcu &mcu)
+	    : m_params(params),
+	      m_sched(sched),
+	      m_stats(stats),
+	      m_mcu(mcu),
+	      m_rng(params.seed)
+	{
+	}
+
+	/**
+	 * Called when the current bus operation completed. Raises the TWI
+	 * interrupt in the slave; the master is stalled by clock stretching until
+	 * the slave ISR ran.
+	 */
+	void bus_done()
+	{
+		const BusStep &s = m_requests.front().steps[m_step];
+		uint8_t status = 0;
+		switch (s.op) {
+			case OP_START_W:
+				status = TW_SR_SLA_ACK;
+				m_slave_addressed = true;
+				break;
+			case OP_WRITE:
+				status = TW_SR_DATA_ACK;
+				m_mcu.twdr = s.data;
+				break;
+			case OP_RSTART:
+				status = TW_SR_STOP;
+				m_slave_addressed = false;
+				break;
+			case OP_ADDR_R:
+				status = TW_ST_SLA_ACK;
+				break;
+			case OP_READ_ACK:
+				status = TW_ST_DATA_ACK;
+				break;
+			case OP_READ_NACK:
+				status = TW_ST_DATA_NACK;
+				break;
+			case OP_STOP:
+				if (m_slave_addressed) {
+					status = TW_SR_STOP;
+					m_slave_addressed = false;
+				}
+				break;
+		}
+		m_step++;
+		if (status == 0) {
+			next();
+			return;
+		}
+		m_mcu.twi_interrupt(status);
+		if (s.op == OP_STOP) {
+			next();  // The bus is released, no clock stretching
+		}
+		else {
+			m_waiting_for_slave = true;
+		}
+	}
+
+	/**
+	 * Called when the TWI ISR cleared TWINT.
+	 */
+	void slave_ready()
+	{
+		if (m_waiting_for_slave) {
+			m_waiting_for_slave = false;
+			next();
+		}
+	}
+
+	void request()
+	{
+		std::vector<BusStep> steps;
+		const double r = std::uniform_real_distribution<>(0.0, 1.0)(m_rng);
+		if (r < 0.9) {
+			read_regs(steps, 0x00, 7);  // ds1307_get_time()
+			submit(std::move(steps), true);
+		}
+		else if (r < 0.95) {
+			read_regs(steps, 0x07, 9);  // ds1337_read_alarm()
+			submit(std::move(steps), false);
+		}
+		else {
+			read_regs(steps, 0x11, 2);  // ds3232_hwmon_read_temp()
+			submit(std::move(steps), false);
+		}
+	}
+
+	/**
+	 * Services the alarm interrupt like ds3232_irq() and re-arms Alarm 1 like
+	 * ds3232_set_alarm(), as a daemon waking up once per minute would.
+	 */
+	void alarm()
+	{
+		std::vector<BusStep> steps;
+		read_regs(steps, 0x0E, 1);
+		read_regs(steps, 0x0F, 1);
+		const uint8_t ctrl_irq_off = 0x04, status_clr = 0x00;
+		write_regs(steps, 0x0E, &ctrl_irq_off, 1);
+		write_regs(steps, 0x0F, &status_clr, 1);
+
+		read_regs(steps, 0x0E, 2);
+		write_regs(steps, 0x0E, &ctrl_irq_off, 1);
+		write_regs(steps, 0x0F, &status_clr, 1);
+		write_regs(steps, 0x07, ALARM_EVERY_MINUTE, 4);
+		const uint8_t ctrl_irq_on = 0x05;
+		write_regs(steps, 0x0E, &ctrl_irq_on, 1);
+		submit(std::move(steps), false);
+	}
+
+	void set_time()
+	{
+		// ds1307_set_time(): write the time, then clear OSF in the status
+		// register using a read-modify-write cycle
+		uint8_t regs[7];
+		const int64_t epoch = m_mcu.expected_epoch(m_sched.now());
+		epoch_to_regs(epoch, regs);
+		m_mcu.set_epoch_written(epoch);
+		std::vector<BusStep> steps;
+		write_regs(steps, 0x00, regs, 7);
+		read_regs(steps, 0x0F, 1);
+		const uint8_t status = 0x08;
+		write_regs(steps, 0x0F, &status, 1);
+		submit(std::move(steps), false);
+	}
+
+	uint64_t poll_delay(double interval_ms)
+	{
+		std::uniform_real_distribution<> dist(1.0 - m_params.jitter,
+		                                      1.0 + m_params.jitter);
+		return uint64_t(interval_ms * 1e-3 * dist(m_rng) * m_params.f_cpu);
+	}
+};
+
+/******************************************************************************
+ * Main program                                                               *
+ ******************************************************************************/
+
+static void simulate(const Params &params, uint32_t coalesce, bool alarm,
+                     double poll_ms)
+{
+	Scheduler sched;
+	Stats stats;
+	Mcu mcu(params, sched, stats, coalesce, alarm);
+	Host host(params, sched, stats, mcu);
+
+	const uint64_t t_end = uint64_t(params.days * 86400.0 * params.f_cpu);
+	const uint64_t t_set = uint64_t(params.set_interval * params.f_cpu);
+	if (poll_ms > 0.0) {
+		sched.schedule(host.poll_delay(poll_ms), EV_HOST_REQUEST);
+	}
+	if (t_set > 0) {
+		sched.schedule(t_set, EV_HOST_SET_TIME);
+	}
+
+	const auto t0 = std::chrono::steady_clock::now();
+	Event ev;
+	while (sched.pop(ev) && ev.t < t_end) {
+		switch (ev.type) {
+			case EV_TIMER_COMPARE:
+				mcu.timer_compare(ev.arg);
+				break;
+			case EV_BUS_DONE:
+				host.bus_done();
+				break;
+			case EV_CPU_DONE:
+				if (mcu.done() == Mcu::CPU_TWI_ISR) {
+					host.slave_ready();
+				}
+				mcu.dispatch();
+				break;
+			case EV_HOST_REQUEST:
+				host.request();
+				sched.schedule(ev.t + host.poll_delay(poll_ms),
+				               EV_HOST_REQUEST);
+				break;
+			case EV_HOST_SET_TIME:
+				host.set_time();
+				sched.schedule(ev.t + t_set, EV_HOST_SET_TIME);
+				break;
+			case EV_HOST_ALARM:
+				host.alarm();
+				break;
+		}
+	}
+	const double wall = std::chrono::duration<double>(
+	                        std::chrono::steady_clock::now() - t0)
+	                        .count();
+
+	const Histogram &lat = stats.latency;
+	printf("%6u %5d %9.1f %9llu %8.1f %8.1f %8.1f %8.1f %8.4f %10.3g %10.3g "
+	       "%8.1f %9.0f %9.2f %8.4f %9.1f %7.2f\n",
+	       unsigned(coalesce), int(alarm), poll_ms,
+	       (unsigned long long)lat.n(), lat.mean(), lat.percentile(0.5),
+	       lat.percentile(0.99), lat.max(),
+	       100.0 * double(stats.isr_cycles) / double(t_end),
+	       stats.ticks ? double(stats.missed_ticks) / stats.ticks : 0.0,
+	       stats.reads ? double(stats.stale_reads) / stats.reads : 0.0,
+	       double(stats.max_tick_latency) * 1e6 / params.f_cpu,
+	       double(stats.wakeups) / params.days,
+	       double(stats.awake_cycles) * 1e-6 / params.days,
+	       100.0 * double(stats.awake_cycles) / double(t_end),
+	       double(stats.max_alarm_latency) * 1e3 / params.f_cpu, wall);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+	        "Usage: %s [--days D] [--scl HZ] [--cpu HZ] [--poll MS[,MS...]]\n"
+	        "          [--coalesce S[,S...]] [--alarm 0|1[,0|1]]\n"
+	        "          [--tick-isr CYCLES] [--twi-isr CYCLES]\n"
+	        "          [--update CYCLES] [--wake CYCLES] [--set-interval S]\n"
+	        "          [--seed N]\n",
+	        name);
+}
+
+static std::vector<double> parse_list(const char *s)
+{
+	std::vector<double> res;
+	while (*s) {
+		char *end;
+		res.push_back(std::strtod(s, &end));
+		s = (*end == ',') ? (end + 1) : end;
+		if (end == s && *s) {
+			break;
+		}
+	}
+	return res;
+}
+
+int main(int argc, char *argv[])
+{
+	Params params;
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		if (i + 1 >= argc) {
+			usage(argv[0]);
+			return 1;
+		}
+		const char *val = argv[++i];
+		if (arg == "--days") {
+			params.days = std::strtod(val, nullptr);
+		}
+		else if (arg == "--scl") {
+			params.f_scl = std::strtoul(val, nullptr, 10);
+		}
+		else if (arg == "--cpu") {
+			params.f_cpu = std::strtoul(val, nullptr, 10);
+			params.timer_period = params.f_cpu;
+		}
+		else if (arg == "--poll") {
+			params.polls = parse_list(val);
+		}
+		else if (arg == "--coalesce") {
+			params.coalesce.clear();
+			for (double x : parse_list(val)) {
+				params.coalesce.push_back(
+				    uint32_t(std::min(std::max(x, 1.0), 59.0)));
+			}
+		}
+		else if (arg == "--alarm") {
+			params.alarms.clear();
+			for (double x : parse_list(val)) {
+				params.alarms.push_back(x != 0.0);
+			}
+		}
+		else if (arg == "--tick-isr") {
+			params.c_tick = std::strtoul(val, nullptr, 10);
+		}
+		else if (arg == "--twi-isr") {
+			params.c_twi = std::strtoul(val, nullptr, 10);
+		}
+		else if (arg == "--update") {
+			params.c_update = std::strtoul(val, nullptr, 10);
+		}
+		else if (arg == "--wake") {
+			params.c_wake = std::strtoul(val, nullptr, 10);
+		}
+		else if (arg == "--set-interval") {
+			params.set_interval = std::strtod(val, nullptr);
+		}
+		else if (arg == "--seed") {
+			params.seed = std::strtoull(val, nullptr, 10);
+		}
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	printf("# %.2f days per run, f_cpu = %u Hz, f_scl = %u Hz\n", params.days,
+	       params.f_cpu, params.f_scl);
+	printf("# %4s %5s %9s %9s %8s %8s %8s %8s %8s %10s %10s %8s %9s %9s %8s "
+	       "%9s %7s\n",
+	       "coal", "alarm", "poll_ms", "requests", "lat_avg", "lat_p50",
+	       "lat_p99", "lat_max", "isr_%", "p_missed", "p_stale", "tick_lat",
+	       "wake/day", "Mcyc/day", "awake_%", "alarm_ms", "wall_s");
+	for (uint32_t alarm : params.alarms) {
+		for (uint32_t coalesce : params.coalesce) {
+			for (double poll : params.polls) {
+				simulate(params, coalesce, alarm != 0, poll);
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,359 @@
+/**
+ *  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file soft323xd.cpp
+ *
+ * Daemon hosting up to 65536 virtual Soft323x devices, addressed by a 16-bit
+ * device number. Clients access the device registers over a Unix domain
+ * socket using the protocol in soft323xd_protocol.hpp. Devices are created on
+ * first access and derive their time lazily from CLOCK_MONOTONIC, i.e. the
+ * elapsed ticks are only applied when a device is accessed. Optionally, the
+ * devices run at a multiple of real time.
+ */
+
+#include "soft323xd_protocol.hpp"
+
+#include <soft323x/soft323x.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+/******************************************************************************
+ * Virtual devices                                                            *
+ ******************************************************************************/
+
+static uint64_t monotonic_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return uint64_t(ts.tv_sec) * 1000000000ULL + uint64_t(ts.tv_nsec);
+}
+
+class Device {
+private:
+	static constexpr uint64_t NS_PER_TICK = 1000000000ULL;
+
+	Soft323x<> m_rtc;
+	uint64_t m_origin;  // Monotonic time of the last timer reset
+	uint64_t m_ticks;   // Ticks applied since m_origin
+
+public:
+	/**
+	 * Number of simulated seconds per second of real time.
+	 */
+	static uint32_t speed;
+
+	explicit Device(uint64_t now) : m_origin(now), m_ticks(0) {}
+
+	/**
+	 * Applies all ticks elapsed until the given monotonic time. Long
+	 * intervals are skipped in bulk; alarms are flagged as if the device had
+	 * been ticked every second.
+	 */
+	void sync(uint64_t now)
+	{
+		const uint64_t dt = now - m_origin;
+		const uint64_t target = (dt / NS_PER_TICK) * speed +
+		                        ((dt % NS_PER_TICK) * speed) / NS_PER_TICK;
+		uint64_t n = target - m_ticks;
+		while (n > 0) {
+			const uint32_t k = (n > 0xFFFFFFFFULL) ? 0xFFFFFFFFUL : uint32_t(n);
+			m_rtc.advance(k);
+			n -= k;
+		}
+		m_ticks = target;
+	}
+
+	void read(uint8_t reg, uint8_t *buf, uint8_t len)
+	{
+		for (uint8_t i = 0; i < len; i++) {
+			buf[i] = m_rtc.i2c_read(reg);
+			reg = m_rtc.i2c_next_addr(reg);
+		}
+	}
+
+	void write(uint8_t reg, const uint8_t *buf, uint8_t len, uint64_t now)
+	{
+		for (uint8_t i = 0; i < len; i++) {
+			if (m_rtc.i2c_write(reg, buf[i]) & m_rtc.ACTION_RESET_TIMER) {
+				m_origin = now;
+				m_ticks = 0;
+			}
+			reg = m_rtc.i2c_next_addr(reg);
+		}
+		m_rtc.update();
+	}
+};
+
+uint32_t Device::speed = 1;
+
+/******************************************************************************
+ * Connections                                                                *
+ ******************************************************************************/
+
+struct Connection {
+	int fd;
+	std::vector<uint8_t> in;   // Received, not yet processed bytes
+	std::vector<uint8_t> out;  // Responses not yet sent
+	size_t out_offs = 0;
+
+	explicit Connection(int fd) : fd(fd) {}
+	~Connection() { close(fd); }
+};
+
+class Server {
+private:
+	static constexpr size_t READ_SIZE = 65536;
+
+	int m_epoll;
+	int m_listen;
+	std::vector<std::unique_ptr<Device>> m_devices;
+	std::vector<uint8_t> m_buf;
+
+	Device &device(uint16_t idx, uint64_t now)
+	{
+		std::unique_ptr<Device> &dev = m_devices[idx];
+		if (!dev) {
+			dev.reset(new Device(now));
+		}
+		dev->sync(now);
+		return *dev;
+	}
+
+	/**
+	 * Processes all complete requests in the input buffer and appends the
+	 * responses to the output buffer.
+	 */
+	void process(Connection &c)
+	{
+		const uint64_t now = monotonic_ns();
+		size_t offs = 0;
+		while (c.in.size() - offs >= sizeof(Soft323xdRequest)) {
+			Soft323xdRequest req;
+			memcpy(&req, &c.in[offs], sizeof(req));
+			const size_t n_data = (req.op == SOFT323XD_OP_WRITE) ? req.len : 0;
+			if (c.in.size() - offs < sizeof(req) + n_data) {
+				break;  // Incomplete request
+			}
+			const uint8_t *data = &c.in[offs + sizeof(req)];
+			offs += sizeof(req) + n_data;
+
+			Soft323xdResponse res{SOFT323XD_STATUS_OK, 0, req.tag};
+			const size_t res_offs = c.out.size();
+			c.out.resize(res_offs + sizeof(res));
+			if (req.op == SOFT323XD_OP_READ) {
+				res.len = req.len;
+				c.out.resize(res_offs + sizeof(res) + req.len);
+				device(req.device, now)
+				    .read(req.reg, &c.out[res_offs + sizeof(res)], req.len);
+			}
+			else if (req.op == SOFT323XD_OP_WRITE) {
+				device(req.device, now).write(req.reg, data, req.len, now);
+			}
+			else {
+				res.status = SOFT323XD_STATUS_BAD_OP;
+			}
+			memcpy(&c.out[res_offs], &res, sizeof(res));
+		}
+		c.in.erase(c.in.begin(), c.in.begin() + offs);
+	}
+
+	/**
+	 * Sends as much of the output buffer as possible. Returns false if the
+	 * connection should be closed.
+	 */
+	bool flush(Connection &c)
+	{
+		while (c.out_offs < c.out.size()) {
+			const ssize_t n = send(c.fd, &c.out[c.out_offs],
+			                       c.out.size() - c.out_offs, MSG_NOSIGNAL);
+			if (n < 0) {
+				return errno == EAGAIN || errno == EWOULDBLOCK;
+			}
+			c.out_offs += size_t(n);
+		}
+		c.out.clear();
+		c.out_offs = 0;
+		return true;
+	}
+
+	/**
+	 * Handles readable/writable events on a client connection. Returns false
+	 * if the connection should be closed.
+	 */
+	bool handle(Connection &c, uint32_t events)
+	{
+		if (events & (EPOLLHUP | EPOLLERR)) {
+			return false;
+		}
+		if (events & EPOLLIN) {
+			while (true) {
+				const ssize_t n = recv(c.fd, m_buf.data(), m_buf.size(), 0);
+				if (n == 0) {
+					return false;
+				}
+				if (n < 0) {
+					if (errno == EAGAIN || errno == EWOULDBLOCK) {
+						break;
+					}
+					return false;
+				}
+				c.in.insert(c.in.end(), m_buf.begin(), m_buf.begin() + n);
+			}
+			process(c);
+		}
+		if (!flush(c)) {
+			return false;
+		}
+
+		// Only wait for the socket to become writable if there is data left
+		struct epoll_event ev;
+		ev.events = EPOLLIN | (c.out.empty() ? 0U : uint32_t(EPOLLOUT));
+		ev.data.ptr = &c;
+		epoll_ctl(m_epoll, EPOLL_CTL_MOD, c.fd, &ev);
+		return true;
+	}
+
+	void accept_all()
+	{
+		while (true) {
+			const int fd = accept4(m_listen, nullptr, nullptr, SOCK_NONBLOCK);
+			if (fd < 0) {
+				break;
+			}
+			Connection *c = new Connection(fd);
+			struct epoll_event ev;
+			ev.events = EPOLLIN;
+			ev.data.ptr = c;
+			epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev);
+		}
+	}
+
+public:
+	Server() : m_epoll(-1), m_listen(-1), m_devices(65536), m_buf(READ_SIZE)
+	{
+	}
+
+	~Server()
+	{
+		if (m_listen >= 0) {
+			close(m_listen);
+		}
+		if (m_epoll >= 0) {
+			close(m_epoll);
+		}
+	}
+
+	bool listen(const char *path)
+	{
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (strlen(path) >= sizeof(addr.sun_path)) {
+			fprintf(stderr, "Socket path too long\n");
+			return false;
+		}
+		strcpy(addr.sun_path, path);
+		unlink(path);
+
+		m_listen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if (m_listen < 0 ||
+		    bind(m_listen, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		    ::listen(m_listen, 128) < 0) {
+			perror("soft323xd");
+			return false;
+		}
+
+		m_epoll = epoll_create1(0);
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = nullptr;
+		epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_listen, &ev);
+		return true;
+	}
+
+	void run()
+	{
+		struct epoll_event events[64];
+		while (true) {
+			const int n = epoll_wait(m_epoll, events, 64, -1);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				perror("soft323xd");
+				return;
+			}
+			for (int i = 0; i < n; i++) {
+				Connection *c = static_cast<Connection *>(events[i].data.ptr);
+				if (!c) {
+					accept_all();
+				}
+				else if (!handle(*c, events[i].events)) {
+					epoll_ctl(m_epoll, EPOLL_CTL_DEL, c->fd, nullptr);
+					delete c;
+				}
+			}
+		}
+	}
+};
+
+/******************************************************************************
+ * Main program                                                               *
+ ******************************************************************************/
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "x:")) != -1) {
+		switch (opt) {
+			case 'x':
+				Device::speed = uint32_t(std::max(atol(optarg), 1L));
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-x SPEED] [SOCKET]\n", argv[0]);
+				return 1;
+		}
+	}
+	const char *path =
+	    (optind < argc) ? argv[optind] : SOFT323XD_DEFAULT_SOCKET;
+	signal(SIGPIPE, SIG_IGN);
+
+	Server server;
+	if (!server.listen(path)) {
+		return 1;
+	}
+	fprintf(stderr, "soft323xd: listening on %s (x%u)\n", path,
+	        unsigned(Device::speed));
+	server.run();
+	return 1;
+}
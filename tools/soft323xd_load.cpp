@@ -0,0 +1,216 @@
+/**
+ *  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file soft323xd_load.cpp
+ *
+ * Load generator for soft323xd. Opens a number of connections, each sending
+ * batches of register reads (time registers) and writes (alarm 1 seconds) to
+ * random devices, and reports the number of transactions per second and the
+ * latency of the batches.
+ */
+
+#include "soft323xd_protocol.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+struct Params {
+	const char *path = SOFT323XD_DEFAULT_SOCKET;
+	unsigned int connections = 4;
+	unsigned int batch = 16;
+	unsigned int devices = 1024;
+	double duration = 5.0;
+};
+
+struct Result {
+	uint64_t transactions = 0;
+	uint64_t errors = 0;
+	std::vector<double> latencies;  // Batch latencies in microseconds
+};
+
+static bool send_all(int fd, const uint8_t *buf, size_t len)
+{
+	while (len > 0) {
+		const ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+		if (n <= 0) {
+			return false;
+		}
+		buf += n;
+		len -= size_t(n);
+	}
+	return true;
+}
+
+static bool recv_all(int fd, uint8_t *buf, size_t len)
+{
+	while (len > 0) {
+		const ssize_t n = recv(fd, buf, len, 0);
+		if (n <= 0) {
+			return false;
+		}
+		buf += n;
+		len -= size_t(n);
+	}
+	return true;
+}
+
+static void client(const Params &params, unsigned int seed, Result &res)
+{
+	using Clock = std::chrono::steady_clock;
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, params.path, sizeof(addr.sun_path) - 1);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("soft323xd_load");
+		if (fd >= 0) {
+			close(fd);
+		}
+		res.errors++;
+		return;
+	}
+
+	std::mt19937 rng(seed);
+	std::vector<uint8_t> out, in(params.batch * (sizeof(Soft323xdResponse) + 7));
+	const Clock::time_point t_end =
+	    Clock::now() + std::chrono::duration_cast<Clock::duration>(
+	                       std::chrono::duration<double>(params.duration));
+	while (Clock::now() < t_end) {
+		// Assemble the batch
+		out.clear();
+		size_t n_in = 0;
+		for (unsigned int i = 0; i < params.batch; i++) {
+			Soft323xdRequest req{};
+			req.device = uint16_t(rng() % params.devices);
+			req.tag = uint16_t(i);
+			const bool write = (rng() % 10) == 0;
+			req.op = write ? SOFT323XD_OP_WRITE : SOFT323XD_OP_READ;
+			req.reg = write ? 0x07 : 0x00;
+			req.len = write ? 1 : 7;
+			const uint8_t *p = reinterpret_cast<const uint8_t *>(&req);
+			out.insert(out.end(), p, p + sizeof(req));
+			if (write) {
+				out.push_back(uint8_t(rng() % 0x60));
+			}
+			n_in += sizeof(Soft323xdResponse) + (write ? 0 : 7);
+		}
+
+		// Send the batch and wait for all responses
+		const Clock::time_point t0 = Clock::now();
+		if (!send_all(fd, out.data(), out.size()) ||
+		    !recv_all(fd, in.data(), n_in)) {
+			fprintf(stderr, "soft323xd_load: connection lost\n");
+			res.errors++;
+			break;
+		}
+		res.latencies.push_back(
+		    std::chrono::duration<double, std::micro>(Clock::now() - t0)
+		        .count());
+
+		// Check the responses
+		size_t offs = 0;
+		for (unsigned int i = 0; i < params.batch; i++) {
+			Soft323xdResponse r;
+			memcpy(&r, &in[offs], sizeof(r));
+			if (r.status != SOFT323XD_STATUS_OK || r.tag != i) {
+				res.errors++;
+			}
+			offs += sizeof(r) + r.len;
+		}
+		res.transactions += params.batch;
+	}
+	close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+	Params params;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:c:b:d:t:")) != -1) {
+		switch (opt) {
+			case 's':
+				params.path = optarg;
+				break;
+			case 'c':
+				params.connections = unsigned(atoi(optarg));
+				break;
+			case 'b':
+				params.batch = unsigned(atoi(optarg));
+				break;
+			case 'd':
+				params.devices = unsigned(atoi(optarg));
+				break;
+			case 't':
+				params.duration = atof(optarg);
+				break;
+			default:
+				fprintf(stderr,
+				        "Usage: %s [-s SOCKET] [-c CONNECTIONS] [-b BATCH] "
+				        "[-d DEVICES] [-t SECONDS]\n",
+				        argv[0]);
+				return 1;
+		}
+	}
+	params.devices = std::min(std::max(params.devices, 1U), 65536U);
+	params.batch = std::min(std::max(params.batch, 1U), 65536U);
+
+	std::vector<Result> results(params.connections);
+	std::vector<std::thread> threads;
+	for (unsigned int i = 0; i < params.connections; i++) {
+		threads.emplace_back(client, std::cref(params), i + 1,
+		                     std::ref(results[i]));
+	}
+	for (std::thread &t : threads) {
+		t.join();
+	}
+
+	Result total;
+	for (const Result &r : results) {
+		total.transactions += r.transactions;
+		total.errors += r.errors;
+		total.latencies.insert(total.latencies.end(), r.latencies.begin(),
+		                       r.latencies.end());
+	}
+	std::sort(total.latencies.begin(), total.latencies.end());
+	const auto percentile = [&](double p) {
+		return total.latencies.empty()
+		           ? 0.0
+		           : total.latencies[size_t(p * (total.latencies.size() - 1))];
+	};
+	printf("connections: %u, batch: %u, devices: %u\n", params.connections,
+	       params.batch, params.devices);
+	printf("transactions/s: %.4g\n", total.transactions / params.duration);
+	printf("batch latency: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+	       percentile(0.5), percentile(0.99), percentile(1.0));
+	printf("errors: %llu\n", (unsigned long long)total.errors);
+	return total.errors ? 1 : 0;
+}
@@ -0,0 +1,65 @@
+/**
+ *  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Binary protocol spoken by soft323xd over a Unix domain stream socket. A
+ * client sends any number of requests back-to-back; the server answers each
+ * request with a response in the same order. Responses to all requests
+ * received in one read are sent in a single write. All fields are in host
+ * byte order.
+ *
+ * Request:  op (1), reg (1), len (1), reserved (1), device (2), tag (2),
+ *           followed by len data bytes for SOFT323XD_OP_WRITE.
+ * Response: status (1), len (1), tag (2),
+ *           followed by len data bytes for SOFT323XD_OP_READ.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef SOFT323XD_PROTOCOL_HPP
+#define SOFT323XD_PROTOCOL_HPP
+
+#include <stdint.h>
+
+static constexpr const char *SOFT323XD_DEFAULT_SOCKET = "/tmp/soft323xd.sock";
+
+static constexpr uint8_t SOFT323XD_OP_READ = 1;
+static constexpr uint8_t SOFT323XD_OP_WRITE = 2;
+
+static constexpr uint8_t SOFT323XD_STATUS_OK = 0;
+static constexpr uint8_t SOFT323XD_STATUS_BAD_OP = 1;
+
+struct Soft323xdRequest {
+	uint8_t op;
+	uint8_t reg;
+	uint8_t len;
+	uint8_t reserved;
+	uint16_t device;
+	uint16_t tag;
+};
+
+struct Soft323xdResponse {
+	uint8_t status;
+	uint8_t len;
+	uint16_t tag;
+};
+
+static_assert(sizeof(Soft323xdRequest) == 8, "Unexpected request size");
+static_assert(sizeof(Soft323xdResponse) == 4, "Unexpected response size");
+
+#endif /* SOFT323XD_PROTOCOL_HPP */
@@ -0,0 +1,222 @@
+/**
+ *  Soft323x -- Software implementation of the DS323x RTC for 8-bit µCs
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file trace_soft323x.cpp
+ *
+ * Records and replays traces in the format defined in
+ * soft323x/soft323x_trace.hpp. With -g, a synthetic trace of the given number
+ * of days is generated: one tick and main loop update per second, a read of
+ * the time registers every poll interval and a time write followed by a read
+ * of the control registers every eleven minutes, as issued by the Linux
+ * driver. Otherwise, the trace is replayed and the number of events per
+ * second is reported. With -s, the replay additionally reports the number of
+ * time stamp counter cycles spent in each instrumented path (x86 only).
+ */
+
+#include <soft323x/soft323x_probe.hpp>
+#include <soft323x/soft323x_trace.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+
+using RTC = Soft323x<236>;
+
+#if defined(__x86_64__) || defined(__i386__)
+using Probe = Soft323xProbeCycles<Soft323xCyclesTsc>;
+
+struct ProbeConfig : public Soft323xDefaultConfig {
+	using Probe = ::Probe;
+};
+
+using ProbedRTC = Soft323x<236, ProbeConfig>;
+
+/**
+ * Prints the statistics collected by the probes.
+ */
+static void print_probe_stats()
+{
+	static const char *const NAMES[Soft323xProbePath::COUNT] = {
+	    "tick", "update", "increment_time", "check_alarms", "i2c_read",
+	    "i2c_write"};
+	printf("%-15s %12s %8s %8s %8s %8s %8s\n", "path (cycles)", "calls",
+	       "min", "mean", "p50", "p99", "max");
+	for (uint8_t i = 0; i < Soft323xProbePath::COUNT; i++) {
+		const Probe::Stat &s = Probe::stat(i);
+		if (s.count == 0) {
+			continue;
+		}
+		printf("%-15s %12lu %8lu %8.1f %8lu %8lu %8lu\n", NAMES[i],
+		       (unsigned long)s.count, (unsigned long)s.min,
+		       double(s.sum) / double(s.count),
+		       (unsigned long)Probe::percentile(i, 0.5),
+		       (unsigned long)Probe::percentile(i, 0.99),
+		       (unsigned long)s.max);
+	}
+}
+#endif
+
+struct Params {
+	double days = 0.0;  // Generate a trace if non-zero
+	unsigned int poll = 1;
+	unsigned int repeat = 1;
+	bool stats = false;
+	const char *path = nullptr;
+};
+
+static void read_burst(RTC &rtc, Soft323xTraceWriter &trace, uint8_t addr,
+                       uint8_t n)
+{
+	trace.start();
+	rtc.update();
+	for (uint8_t i = 0; i < n; i++) {
+		trace.read(addr, rtc.i2c_read(addr));
+		addr = rtc.i2c_next_addr(addr);
+	}
+	trace.stop();
+}
+
+static void write_burst(RTC &rtc, Soft323xTraceWriter &trace, uint8_t addr,
+                        const uint8_t *data, uint8_t n)
+{
+	trace.start();
+	rtc.update();
+	for (uint8_t i = 0; i < n; i++) {
+		trace.write(addr, data[i]);
+		rtc.i2c_write(addr, data[i]);
+		addr = rtc.i2c_next_addr(addr);
+	}
+	trace.stop();
+}
+
+static int generate(const Params &params)
+{
+	Soft323xTraceWriter trace(params.path);
+	if (!trace.ok()) {
+		perror(params.path);
+		return 1;
+	}
+	RTC rtc;
+	const uint64_t seconds = uint64_t(params.days * 86400.0);
+	for (uint64_t t = 1; t <= seconds; t++) {
+		trace.tick();
+		rtc.tick();
+		trace.update();
+		rtc.update();
+		if (params.poll && t % params.poll == 0) {
+			read_burst(rtc, trace, RTC::REG_SECONDS, 7);
+		}
+		if (t % 660 == 0) {
+			uint8_t regs[7];
+			for (uint8_t i = 0; i < 7; i++) {
+				regs[i] = rtc.i2c_read(i);
+			}
+			write_burst(rtc, trace, RTC::REG_SECONDS, regs, 7);
+			read_burst(rtc, trace, RTC::REG_CTRL_1, 2);
+		}
+	}
+	return 0;
+}
+
+template <typename R>
+static int replay(const Params &params)
+{
+	Soft323xTraceReader reader(params.path);
+	if (!reader.ok()) {
+		fprintf(stderr, "%s: not a valid trace\n", params.path);
+		return 1;
+	}
+	Soft323xTraceReader::Result res;
+	const auto t0 = std::chrono::steady_clock::now();
+	for (unsigned int i = 0; i < params.repeat; i++) {
+		R rtc;
+		res = reader.replay(rtc);
+	}
+	const double dt = std::chrono::duration<double>(
+	                      std::chrono::steady_clock::now() - t0)
+	                      .count();
+	const double n = double(res.events) * params.repeat;
+	printf("%llu events (%llu ticks) in %zu bytes, %.2f bytes/event\n",
+	       (unsigned long long)res.events, (unsigned long long)res.ticks,
+	       reader.size(), double(reader.size()) / double(res.events));
+	printf("%.1f Mevents/s, %.1f MB/s\n", n / dt * 1e-6,
+	       double(reader.size()) * params.repeat / dt * 1e-6);
+	if (res.mismatches) {
+		printf("%llu mismatching reads, first at offset %lld\n",
+		       (unsigned long long)res.mismatches,
+		       (long long)res.first_mismatch);
+	}
+	if (res.invalid) {
+		printf("invalid or truncated trace\n");
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	if (params.stats) {
+		print_probe_stats();
+	}
+#endif
+	return (res.mismatches || res.invalid) ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	Params params;
+	int opt;
+	while ((opt = getopt(argc, argv, "g:p:n:s")) != -1) {
+		switch (opt) {
+			case 'g':
+				params.days = atof(optarg);
+				break;
+			case 'p':
+				params.poll = unsigned(atoi(optarg));
+				break;
+			case 'n':
+				params.repeat = unsigned(atoi(optarg));
+				break;
+			case 's':
+				params.stats = true;
+				break;
+			default:
+				fprintf(stderr,
+				        "Usage: %s [-g DAYS [-p POLL]] [-n REPEAT] [-s] FILE\n",
+				        argv[0]);
+				return 1;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "Usage: %s [-g DAYS [-p POLL]] [-n REPEAT] [-s] FILE\n",
+		        argv[0]);
+		return 1;
+	}
+	params.path = argv[optind];
+	params.repeat = (params.repeat < 1) ? 1 : params.repeat;
+	if (params.days > 0.0) {
+		return generate(params);
+	}
+	if (params.stats) {
+#if defined(__x86_64__) || defined(__i386__)
+		return replay<ProbedRTC>(params);
+#else
+		fprintf(stderr, "-s is only supported on x86\n");
+		return 1;
+#endif
+	}
+	return replay<RTC>(params);
+}